@@ -78,6 +78,11 @@ local function setGpuAllowance( view )
 	view:setGpuAllowance( allowance );
 end
 
+local function setChunkCacheSize( view )
+	local size = Config.chunk_cache_mem or 256;
+	view:setChunkCacheSize( size * 1024 * 1024 );
+end
+
 local function moveSpawnHere( worldPath, dim, x, y, z )
 	if dim ~= 0 then
 		eihort.errorDialog( "Move spawn", "The spawn must be located in the overworld." );
@@ -249,6 +254,7 @@ function beginMapView( world, worldName )
 	local owSky, setMoonPhase = createOverworldSky();
 	local neSky = createNetherEndSky();
 	setGpuAllowance( worldView );
+	setChunkCacheSize( worldView );
 
 	local mouseX, mouseY = eihort.getMousePos();
 	local ignoreNextMM = false;
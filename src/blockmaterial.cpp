@@ -25,6 +25,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include <memory.h>
 #include <float.h>
 #include <cassert>
+#include <climits>
+#include <algorithm>
 
 #include "blockmaterial.h"
 #include "triangle.h"
@@ -674,7 +676,7 @@ void SolidBlockGeometry::emitContour( GeometryStream *out, const IslandDesc *ctx
 	if( ctx->nContourPoints == 4 && ctx->nHoles == 0 ) {
 		// Big quad
 		emitQuad( out, ctx, offsetPx );
-	} else {
+	} else if( !emitRectilinear( out, ctx, offsetPx ) ) {
 		// Strange shape
 		triangulateio triIn;
 		triangulateio triOut;
@@ -689,23 +691,184 @@ void SolidBlockGeometry::emitContour( GeometryStream *out, const IslandDesc *ctx
 	}
 }
 
+struct RectEdge {
+	int x, y0, y1;
+};
+
+struct RectSpan {
+	int x0, x1, y0;
+};
+
+static inline bool rectEdgeStartsFirst( const RectEdge &a, const RectEdge &b ) {
+	return a.y0 < b.y0;
+}
+
+// Appends the edges of a contour which run along y, in the island's 2D space
+// Returns false if the contour has diagonal edges
+static bool gatherRectEdges( const IslandDesc *ctx, unsigned nPoints, const Point *points, RectEdge *edges, unsigned &nEdges ) {
+	for( unsigned i = 0; i < nPoints; i++ ) {
+		const Point &p = points[i];
+		const Point &q = points[i+1 < nPoints ? i+1 : 0];
+		int px = ctx->xd1 * p.v[ctx->xax], py = ctx->yd1 * p.v[ctx->yax];
+		int qx = ctx->xd1 * q.v[ctx->xax], qy = ctx->yd1 * q.v[ctx->yax];
+		if( px == qx ) {
+			if( py != qy ) {
+				RectEdge &e = edges[nEdges++];
+				e.x = px;
+				e.y0 = std::min( py, qy );
+				e.y1 = std::max( py, qy );
+			}
+		} else if( py != qy ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool SolidBlockGeometry::emitRectilinear( GeometryStream *out, const IslandDesc *ctx, int offsetPx ) {
+	// Cuts the island into rectangles with a sweep along y
+	// Between two consecutive contour vertex heights, the island is the set of
+	// spans between pairs of edges; spans which carry on unchanged into the
+	// next slab are extended rather than emitted
+	const unsigned STACK_POINTS = 128;
+	unsigned totalPoints = ctx->nContourPoints;
+	if( ctx->nHoles )
+		totalPoints += ctx->holeContourEnd[ctx->nHoles-1];
+
+	RectEdge stackEdges[STACK_POINTS*2];
+	RectSpan stackSpans[STACK_POINTS*2];
+	std::vector< RectEdge > heapEdges;
+	std::vector< RectSpan > heapSpans;
+	RectEdge *edges = &stackEdges[0];
+	RectSpan *spans = &stackSpans[0];
+	if( totalPoints > STACK_POINTS ) {
+		heapEdges.resize( totalPoints*2 );
+		heapSpans.resize( totalPoints*2 );
+		edges = &heapEdges[0];
+		spans = &heapSpans[0];
+	}
+	RectEdge *active = edges + totalPoints;
+	RectSpan *nextSpans = spans + totalPoints;
+
+	unsigned nEdges = 0;
+	if( !gatherRectEdges( ctx, ctx->nContourPoints, ctx->contourPoints, edges, nEdges ) )
+		return false;
+	unsigned holeStart = 0;
+	for( unsigned i = 0; i < ctx->nHoles; i++ ) {
+		if( !gatherRectEdges( ctx, ctx->holeContourEnd[i] - holeStart, ctx->holeContourPoints + holeStart, edges, nEdges ) )
+			return false;
+		holeStart = ctx->holeContourEnd[i];
+	}
+	if( nEdges < 2 )
+		return false;
+
+	std::sort( edges, edges + nEdges, rectEdgeStartsFirst );
+
+	short z = (short)(ctx->contourPoints[0].v[ctx->zax] * 16 + ctx->zd * offsetPx);
+	unsigned nActive = 0, nSpans = 0, nextEdge = 0;
+	int y = edges[0].y0;
+	for( ;; ) {
+		// Update the edges crossing this slab, keeping them sorted along x
+		unsigned n = 0;
+		for( unsigned i = 0; i < nActive; i++ ) {
+			if( active[i].y1 > y )
+				active[n++] = active[i];
+		}
+		nActive = n;
+		for( ; nextEdge < nEdges && edges[nextEdge].y0 == y; nextEdge++ ) {
+			unsigned j = nActive++;
+			for( ; j > 0 && active[j-1].x > edges[nextEdge].x; j-- )
+				active[j] = active[j-1];
+			active[j] = edges[nextEdge];
+		}
+		assert( (nActive & 1) == 0 );
+
+		// Pair the edges up into spans
+		unsigned nNext = 0, s = 0;
+		for( unsigned i = 0; i + 1 < nActive; i += 2 ) {
+			int x0 = active[i].x, x1 = active[i+1].x;
+			if( x0 == x1 )
+				continue;
+			for( ; s < nSpans && spans[s].x0 < x0; s++ )
+				emitRect( out, ctx, z, spans[s].x0, spans[s].y0, spans[s].x1, y );
+			if( s < nSpans && spans[s].x0 == x0 && spans[s].x1 == x1 ) {
+				nextSpans[nNext++] = spans[s++];
+			} else {
+				RectSpan &span = nextSpans[nNext++];
+				span.x0 = x0;
+				span.x1 = x1;
+				span.y0 = y;
+			}
+		}
+		for( ; s < nSpans; s++ )
+			emitRect( out, ctx, z, spans[s].x0, spans[s].y0, spans[s].x1, y );
+		std::swap( spans, nextSpans );
+		nSpans = nNext;
+
+		if( !nActive && nextEdge == nEdges )
+			break;
+
+		// Move on to the next vertex height
+		int nextY = nextEdge < nEdges ? edges[nextEdge].y0 : INT_MAX;
+		for( unsigned i = 0; i < nActive; i++ )
+			nextY = std::min( nextY, active[i].y1 );
+		y = nextY;
+	}
+
+	return true;
+}
+
+void SolidBlockGeometry::emitRect( GeometryStream *target, const IslandDesc *ctx, short z, int x0, int y0, int x1, int y1 ) {
+	unsigned indexBase = target->getIndexBase();
+
+	// Counterclockwise in the island's 2D space, as triangulate() outputs
+	const int xs[4] = { x0, x1, x1, x0 };
+	const int ys[4] = { y0, y0, y1, y1 };
+	Vertex vtx;
+	vtx.pos[ctx->zax] = z;
+	for( unsigned i = 0; i < 4; i++ ) {
+		vtx.pos[ctx->xax] = (short)(ctx->xd1 * xs[i] * 16);
+		vtx.pos[ctx->yax] = (short)(ctx->yd1 * ys[i] * 16);
+		target->emitVertex( vtx );
+	}
+
+	target->emitQuad( indexBase, indexBase+1, indexBase+2, indexBase+3 );
+}
+
+static inline unsigned contourPointSlot( int x, int y, unsigned shift ) {
+	return (((unsigned)x * 0x9e3779b1u) ^ ((unsigned)y * 0x85ebca6bu)) >> shift;
+}
+
 unsigned SolidBlockGeometry::serializeContourPoints( const IslandDesc *ctx, unsigned nContourPoints, const Point *points, REALVec *outVec, int *segments, int baseSegIdx, std::vector<REALVec> &extraHoles ) {
 	unsigned pointCount = 1;
 	int prevPoint = 0;
 
-	outVec[0].v[0] = (double)ctx->xd1 * points[0].v[ctx->xax];
-	outVec[0].v[1] = (double)ctx->yd1 * points[0].v[ctx->yax];
+	// Open addressed table of the points output so far, holding index+1
+	// A contour only revisits a point where it pinches
+	unsigned tableBits = 4;
+	while( (1u << tableBits) < nContourPoints * 2 )
+		tableBits++;
+	unsigned tableMask = (1u << tableBits) - 1;
+	std::vector< unsigned > pointTable( tableMask + 1, 0 );
+
+	int x0 = ctx->xd1 * points[0].v[ctx->xax];
+	int y0 = ctx->yd1 * points[0].v[ctx->yax];
+	outVec[0].v[0] = (double)x0;
+	outVec[0].v[1] = (double)y0;
+	pointTable[contourPointSlot( x0, y0, 32 - tableBits )] = 1;
 	segments[1] = baseSegIdx;
 
 	for( unsigned i = 1; i < nContourPoints; i++ ) {
-		double x = (double)ctx->xd1 * points[i].v[ctx->xax];
-		double y = (double)ctx->yd1 * points[i].v[ctx->yax];
+		int ix = ctx->xd1 * points[i].v[ctx->xax];
+		int iy = ctx->yd1 * points[i].v[ctx->yax];
+		double x = (double)ix;
+		double y = (double)iy;
 		unsigned pointIndex;
 
-		// TODO: Use a better algorithm for this!
-		// Slows down big contour processing to cover a very rare case
-		for( pointIndex = 0; pointIndex < pointCount; pointIndex++ ) {
-			if( abs( x - outVec[pointIndex].v[0] ) < 0.01 && abs( y - outVec[pointIndex].v[1] ) < 0.01 ) {
+		unsigned slot = contourPointSlot( ix, iy, 32 - tableBits );
+		for( ; pointTable[slot]; slot = (slot + 1) & tableMask ) {
+			pointIndex = pointTable[slot] - 1;
+			if( outVec[pointIndex].v[0] == x && outVec[pointIndex].v[1] == y ) {
 				// An extra hole point is needed here
 				REALVec d1 = {{ outVec[pointIndex+1].v[0] - x, outVec[pointIndex+1].v[1] - y }};
 				REALVec d2 = {{ outVec[prevPoint].v[0] - x, outVec[prevPoint].v[1] - y }};
@@ -725,6 +888,8 @@ unsigned SolidBlockGeometry::serializeContourPoints( const IslandDesc *ctx, unsi
 			}
 		}
 
+		pointIndex = pointCount;
+		pointTable[slot] = pointCount + 1;
 		outVec[pointCount].v[0] = x;
 		outVec[pointCount].v[1] = y;
 		pointCount++;
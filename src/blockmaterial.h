@@ -334,6 +334,9 @@ public:
 	virtual bool beginEmit( GeometryCluster *out, InstanceContext *ctx ) = 0;
 	virtual IslandMode beginIsland( IslandDesc *ctx );
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	// True if an island of whole block faces can be emitted as several
+	// rectangular islands instead
+	virtual bool allowsRectIslands() const { return false; }
 	//virtual void exportOBJ( GeometryCluster *cluster );
 
 	inline bool operator< ( const BlockGeometry& other ) {
@@ -472,6 +475,7 @@ public:
 	virtual bool beginEmit( GeometryCluster *out, InstanceContext *ctx );
 	virtual IslandMode beginIsland( IslandDesc *ctx );
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	virtual bool allowsRectIslands() const { return true; }
 
 	inline void setColor( unsigned col ) { color = col; }
 	inline void setTexScale( float x, float y ) { xTexScale = x; yTexScale = y; }
@@ -499,6 +503,8 @@ protected:
 	};
 
 	static void emitContour( GeometryStream *out, const IslandDesc *ctx, int offsetPx );
+	static bool emitRectilinear( GeometryStream *out, const IslandDesc *ctx, int offsetPx );
+	static void emitRect( GeometryStream *out, const IslandDesc *ctx, short z, int x0, int y0, int x1, int y1 );
 	static unsigned serializeContourPoints( const IslandDesc *ctx, unsigned nContourPoints, const Point *points, REALVec *outVec, int *segments, int baseSegIdx, std::vector<REALVec> &extraHoles );
 	static void islandToTriangleIO( const IslandDesc *ctx, triangulateio *out );
 	static void freeIslandTriangleIO( triangulateio *out );
@@ -558,6 +564,7 @@ public:
 	~PortalBlockGeometry();
 
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	virtual bool allowsRectIslands() const { return false; }
 };
 
 class CactusBlockGeometry : public SolidBlockGeometry {
@@ -571,6 +578,7 @@ public:
 	virtual void render( void *&meta, RenderContext *ctx );
 	virtual IslandMode beginIsland( IslandDesc *ctx );
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	virtual bool allowsRectIslands() const { return false; }
 
 protected:
 	int offsets[6];
@@ -610,6 +618,7 @@ public:
 	virtual bool beginEmit( GeometryCluster *out, InstanceContext *ctx );
 	virtual IslandMode beginIsland( IslandDesc *ctx );
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	virtual bool allowsRectIslands() const { return false; }
 
 protected:
 	int top, bottom;
@@ -626,6 +635,7 @@ public:
 	virtual bool beginEmit( GeometryCluster *out, InstanceContext *ctx );
 	virtual IslandMode beginIsland( IslandDesc *ctx );
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	virtual bool allowsRectIslands() const { return false; }
 
 protected:
 	int offsets[6];
@@ -643,6 +653,7 @@ public:
 	virtual bool beginEmit( GeometryCluster *out, InstanceContext *ctx );
 	virtual IslandMode beginIsland( IslandDesc *ctx );
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	virtual bool allowsRectIslands() const { return false; }
 	
 	inline void showFace( unsigned emit, unsigned face, bool show ) const { offsets[emit].hide[face] = !show; }
 	
@@ -671,6 +682,7 @@ public:
 	virtual bool beginEmit( GeometryCluster *out, InstanceContext *ctx );
 	virtual IslandMode beginIsland( IslandDesc *ctx );
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	virtual bool allowsRectIslands() const { return false; }
 	
 	inline void showFace( unsigned emit, unsigned face, bool show ) const { offsets[emit].hide[face] = !show; }
 	
@@ -696,6 +708,7 @@ public:
 	virtual GeometryCluster *newCluster();
 	virtual IslandMode beginIsland( IslandDesc *ctx );
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	virtual bool allowsRectIslands() const { return false; }
 	
 protected:
 	// To access protected members of texFlipped
@@ -712,6 +725,7 @@ public:
 	
 	virtual IslandMode beginIsland( IslandDesc *ctx );
 	virtual void emitIsland( GeometryCluster *out, const IslandDesc *ctx );
+	virtual bool allowsRectIslands() const { return false; }
 
 protected:
 	static bool continueIsland( IslandDesc *island, const InstanceContext *nextBlock );
@@ -0,0 +1,192 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "blockvolume.h"
+#include "mcmap.h"
+#include "mcblockdesc.h"
+
+BlockVolume::BlockVolume()
+: originX(0), originY(0), originZ(0)
+, sizeX(0), sizeY(0), sizeZ(0)
+, strideY(0), maskWords(0)
+, ids(NULL), data(NULL), light(NULL), columns(NULL), masks(NULL)
+, mem(NULL), memSize(0)
+{
+}
+
+BlockVolume::~BlockVolume() {
+	free( mem );
+}
+
+void BlockVolume::release() {
+	free( mem );
+	mem = NULL;
+	memSize = 0;
+	ids = NULL;
+	data = NULL;
+	light = NULL;
+	columns = NULL;
+	masks = NULL;
+	sizeX = sizeY = 0;
+}
+
+static inline size_t alignToCacheLine( size_t n ) {
+	return (n + 63) & ~(size_t)63;
+}
+
+void BlockVolume::reserve( unsigned nColumns, unsigned zStride, unsigned nMaskWords ) {
+	size_t blocks = (size_t)nColumns * zStride;
+	size_t idBytes = alignToCacheLine( blocks * sizeof(unsigned short) );
+	size_t byteBytes = alignToCacheLine( blocks );
+	size_t maskBytes = (size_t)nColumns * MASK_PLANES * nMaskWords * sizeof(uint64_t);
+	size_t infoBytes = alignToCacheLine( nColumns * sizeof(ColumnInfo) );
+	size_t needed = idBytes + 2 * byteBytes + maskBytes + infoBytes + 64;
+	if( needed > memSize ) {
+		free( mem );
+		mem = malloc( needed );
+		memSize = mem ? needed : 0;
+	}
+
+	unsigned char *p = (unsigned char*)alignToCacheLine( (size_t)mem );
+	ids = (unsigned short*)p;
+	p += idBytes;
+	data = p;
+	p += byteBytes;
+	light = p;
+	p += byteBytes;
+	masks = (uint64_t*)p;
+	p += maskBytes;
+	columns = (ColumnInfo*)p;
+}
+
+void BlockVolume::gather( MCMap *map, int minx, int maxx, int miny, int maxy, int minz, int maxz, int border ) {
+	originX = minx - border;
+	originY = miny - border;
+	originZ = minz - 1;
+	sizeX = (unsigned)(maxx - minx + 1 + 2*border);
+	sizeY = (unsigned)(maxy - miny + 1 + 2*border);
+	sizeZ = (unsigned)(maxz - minz + 3);
+	// Keep each column of ids on a 32-byte boundary
+	strideY = (sizeZ + 15) & ~15u;
+	maskWords = (sizeZ + 63) >> 6;
+	reserve( sizeX * sizeY, strideY, maskWords );
+	if( !mem ) {
+		sizeX = sizeY = 0;
+		return;
+	}
+
+	int z1 = originZ + (int)sizeZ - 1;
+	for( unsigned cx = 0; cx < sizeX; cx++ ) {
+		for( unsigned cy = 0; cy < sizeY; cy++ ) {
+			unsigned c = cx * sizeY + cy;
+			size_t base = (size_t)c * strideY;
+			ColumnInfo &info = columns[c];
+			MCMap::Column col;
+			if( map->getColumn( originX + (int)cx, originY + (int)cy, col ) ) {
+				col.copyBlocks( originZ, z1, ids + base, data + base, light + base );
+				info.minZ = col.minZ;
+				info.maxZ = col.maxZ;
+				info.bottomZ = col.bottomZ;
+				info.topZ = col.topZ;
+				info.present = true;
+			} else {
+				for( unsigned zo = 0; zo < sizeZ; zo++ )
+					ids[base + zo] = (unsigned short)(originZ + (int)zo < 0 ? 7 : 1);
+				memset( data + base, 0, sizeZ );
+				memset( light + base, 0, sizeZ );
+				info.minZ = info.bottomZ = originZ;
+				info.maxZ = info.topZ = z1;
+				info.present = false;
+			}
+		}
+	}
+}
+
+void BlockVolume::buildMasks( const MCBlockDesc *blocks ) {
+	unsigned char planeBits[BLOCK_ID_COUNT];
+	for( unsigned id = 0; id < BLOCK_ID_COUNT; id++ ) {
+		unsigned flags = blocks->getFlags( id );
+		planeBits[id] = (unsigned char)((flags & 0x3fu)
+			| (blocks->shouldHighlight( id ) ? 1u << PLANE_HIGHLIGHT : 0u)
+			| (blocks->getGeometry( id ) ? 1u << PLANE_GEOMETRY : 0u));
+	}
+
+	size_t planeWords = (size_t)MASK_PLANES * maskWords;
+	unsigned nColumns = sizeX * sizeY;
+	for( unsigned c = 0; c < nColumns; c++ ) {
+		uint64_t *planes = masks + c * planeWords;
+		memset( planes, 0, planeWords * sizeof(uint64_t) );
+
+		// Air usually contributes nothing, so only the non-air span and the
+		// bedrock below the map are needed
+		const ColumnInfo &info = columns[c];
+		int z0 = 0, z1 = (int)sizeZ;
+		if( !planeBits[0] ) {
+			int lo = info.bottomZ, hi = info.topZ;
+			if( originZ < 0 ) {
+				lo = originZ;
+				hi = std::max( hi, -1 );
+			}
+			z0 = std::max( lo - originZ, 0 );
+			z1 = std::min( hi - originZ + 1, (int)sizeZ );
+		}
+
+		const unsigned short *colIds = ids + (size_t)c * strideY;
+		for( unsigned zo = (unsigned)z0; (int)zo < z1; zo++ ) {
+			unsigned bits = planeBits[colIds[zo]];
+			uint64_t bit = (uint64_t)1 << (zo & 63);
+			uint64_t *word = planes + (zo >> 6);
+			for( ; bits; bits &= bits - 1 )
+				word[lowestSetBit( bits ) * maskWords] |= bit;
+		}
+	}
+}
+
+void BlockVolume::getExposedMask( int x, int y, uint64_t *out ) const {
+	const uint64_t *self = getPlanes( x, y );
+	const uint64_t *side0 = getPlanes( x - 1, y );
+	const uint64_t *side1 = getPlanes( x + 1, y ) + maskWords;
+	const uint64_t *side2 = getPlanes( x, y - 1 ) + 2 * maskWords;
+	const uint64_t *side3 = getPlanes( x, y + 1 ) + 3 * maskWords;
+	const uint64_t *solidBelow = self + 4 * maskWords;
+	const uint64_t *solidAbove = self + 5 * maskWords;
+	const uint64_t *highlight = self + PLANE_HIGHLIGHT * maskWords;
+	const uint64_t *geometry = self + PLANE_GEOMETRY * maskWords;
+
+	// The block below z is at bit z-1, and the block above at bit z+1
+	uint64_t carry = 0;
+	for( unsigned w = 0; w < maskWords; w++ ) {
+		uint64_t below = (solidBelow[w] << 1) | carry;
+		carry = solidBelow[w] >> 63;
+		uint64_t above = solidAbove[w] >> 1;
+		if( w + 1 < maskWords )
+			above |= solidAbove[w+1] << 63;
+		uint64_t hidden = side0[w] & side1[w] & side2[w] & side3[w] & below & above;
+		out[w] = (~hidden | highlight[w]) & geometry[w];
+	}
+}
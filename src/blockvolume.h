@@ -0,0 +1,180 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#ifndef BLOCKVOLUME_H
+#define BLOCKVOLUME_H
+
+#include "stdint.h"
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+class MCMap;
+class MCBlockDesc;
+
+// A dense copy of the blocks around the area being meshed
+// Columns are laid out z-first with fixed strides, so that neighbouring
+// blocks are found with pointer arithmetic alone. Columns missing from
+// the map are filled with solid blocks.
+class BlockVolume {
+public:
+	BlockVolume();
+	~BlockVolume();
+
+	// Frees the arrays; the next gather allocates them again
+	void release();
+
+	struct Column {
+		inline unsigned getId( int z ) const { return id[z]; }
+		inline unsigned getData( int z ) const { return data[z]; }
+		inline unsigned getBlockLight( int z ) const { return light[z] & 0xfu; }
+		inline unsigned getSkyLight( int z ) const { return light[z] >> 4; }
+
+		// These are offset so that they are indexed by z directly
+		const unsigned short *id;
+		const unsigned char *data;
+		const unsigned char *light;
+		// As in MCMap::Column
+		int minZ, maxZ;
+		int bottomZ, topZ;
+	};
+
+	// Copies every column from minx-border to maxx+border and miny-border
+	// to maxy+border, from minz-1 to maxz+1
+	void gather( MCMap *map, int minx, int maxx, int miny, int maxy, int minz, int maxz, int border );
+
+	// Returns false if the column is not in the map; col then refers to
+	// the solid stand-in, unless it is also outside of the volume
+	inline bool getColumn( int x, int y, Column &col ) const {
+		unsigned cx = (unsigned)(x - originX), cy = (unsigned)(y - originY);
+		if( cx >= sizeX || cy >= sizeY )
+			return false;
+		unsigned c = cx * sizeY + cy;
+		size_t base = (size_t)c * strideY - originZ;
+		col.id = ids + base;
+		col.data = data + base;
+		col.light = light + base;
+		const ColumnInfo &info = columns[c];
+		col.minZ = info.minZ;
+		col.maxZ = info.maxZ;
+		col.bottomZ = info.bottomZ;
+		col.topZ = info.topZ;
+		return info.present;
+	}
+
+	// Builds bit planes of the volume's blocks, one bit per block along z,
+	// so that hidden blocks can be found a whole column at a time
+	void buildMasks( const MCBlockDesc *blocks );
+
+	// Sets the bit for each block of the column which has geometry and is
+	// either highlighted or not surrounded by solid blocks
+	// x and y must be inside the volume's border, and out must have room
+	// for getMaskWords() words
+	void getExposedMask( int x, int y, uint64_t *out ) const;
+	inline unsigned getMaskWords() const { return maskWords; }
+
+	// Returns the first z from z to stopz with its bit set in mask, or
+	// stopz + 1 if there is none
+	inline int nextInMask( const uint64_t *mask, int z, int stopz ) const {
+		unsigned zo = (unsigned)(z - originZ);
+		unsigned w = zo >> 6;
+		if( w >= maskWords )
+			return stopz + 1;
+		uint64_t bits = mask[w] & (~(uint64_t)0 << (zo & 63));
+		while( !bits ) {
+			if( ++w >= maskWords )
+				return stopz + 1;
+			bits = mask[w];
+		}
+		int found = originZ + (int)((w << 6) + lowestSetBit( bits ));
+		return found <= stopz ? found : stopz + 1;
+	}
+
+	// As MCMap::getBlockID
+	inline bool getBlockID( int x, int y, int z, unsigned short &id ) const {
+		unsigned cx = (unsigned)(x - originX), cy = (unsigned)(y - originY), cz = (unsigned)(z - originZ);
+		if( cx >= sizeX || cy >= sizeY || cz >= sizeZ || z < 0 )
+			return false;
+		unsigned c = cx * sizeY + cy;
+		if( !columns[c].present )
+			return false;
+		id = ids[(size_t)c * strideY + cz];
+		return true;
+	}
+
+private:
+	BlockVolume( const BlockVolume& );
+	BlockVolume &operator=( const BlockVolume& );
+
+	struct ColumnInfo {
+		int minZ, maxZ;
+		int bottomZ, topZ;
+		bool present;
+	};
+
+	enum {
+		// Solid facing each direction, then highlighted, then has geometry
+		PLANE_HIGHLIGHT = 6,
+		PLANE_GEOMETRY = 7,
+		MASK_PLANES = 8
+	};
+
+	static inline unsigned lowestSetBit( uint64_t bits ) {
+#if defined(__GNUC__)
+		return (unsigned)__builtin_ctzll( bits );
+#elif defined(_MSC_VER) && defined(_M_X64)
+		unsigned long i;
+		_BitScanForward64( &i, bits );
+		return (unsigned)i;
+#else
+		unsigned i = 0;
+		for( ; !(bits & 1); bits >>= 1 )
+			i++;
+		return i;
+#endif
+	}
+
+	inline const uint64_t *getPlanes( int x, int y ) const {
+		unsigned c = (unsigned)(x - originX) * sizeY + (unsigned)(y - originY);
+		return masks + (size_t)c * MASK_PLANES * maskWords;
+	}
+
+	void reserve( unsigned nColumns, unsigned zStride, unsigned nMaskWords );
+
+	int originX, originY, originZ;
+	unsigned sizeX, sizeY, sizeZ;
+	unsigned strideY; // Elements between columns; y is the next column
+	unsigned maskWords; // 64-bit words per column in each bit plane
+
+	// The arrays are aligned to cache lines and reused between gathers
+	unsigned short *ids;
+	unsigned char *data;
+	unsigned char *light; // block | sky << 4
+	ColumnInfo *columns;
+	uint64_t *masks; // MASK_PLANES planes per column
+	void *mem;
+	size_t memSize;
+};
+
+#endif // BLOCKVOLUME_H
@@ -0,0 +1,254 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include <cassert>
+#include <cstdlib>
+
+#include "chunkcache.h"
+#include "mcmap.h"
+
+enum {
+	CHUNK_LOADING,
+	CHUNK_READY,
+	CHUNK_FAILED
+};
+
+ChunkCache::ChunkCache( size_t maxBytes )
+: maxBytes(maxBytes)
+{
+	for( unsigned i = 0; i < SHARD_COUNT; i++ ) {
+		Shard &shard = shards[i];
+		shard.lock = SDL_CreateMutex();
+		shard.loaded = SDL_CreateCond();
+		shard.unusedHead = shard.unusedTail = NULL;
+		shard.bytes = 0;
+		shard.maxBytes = maxBytes / SHARD_COUNT;
+		shard.hits = shard.misses = shard.evictions = 0;
+	}
+}
+
+ChunkCache::~ChunkCache() {
+	for( unsigned i = 0; i < SHARD_COUNT; i++ ) {
+		Shard &shard = shards[i];
+		for( ChunkIndex::iterator it = shard.index.begin(); it != shard.index.end(); ++it ) {
+			assert( it->second->refs == 0 );
+			freeChunk( it->second );
+		}
+		SDL_DestroyCond( shard.loaded );
+		SDL_DestroyMutex( shard.lock );
+	}
+}
+
+ChunkCache::Chunk *ChunkCache::acquire( const Coords2D &coords, MCMap *loader ) {
+	Shard &shard = shards[shardOf( coords )];
+	SDL_mutexP( shard.lock );
+
+	ChunkIndex::iterator it = shard.index.find( coords );
+	if( it != shard.index.end() ) {
+		shard.hits++;
+		Chunk *chunk = it->second;
+		if( chunk->refs++ == 0 )
+			unlinkUnused( shard, chunk );
+		while( chunk->state == CHUNK_LOADING )
+			SDL_CondWait( shard.loaded, shard.lock );
+		if( chunk->state != CHUNK_READY ) {
+			releaseLocked( shard, chunk );
+			chunk = NULL;
+		}
+		SDL_mutexV( shard.lock );
+		return chunk;
+	}
+
+	// Claim the chunk so that nobody else decodes it meanwhile
+	shard.misses++;
+	Chunk *chunk = new Chunk;
+	chunk->signs = NULL;
+	chunk->nSigns = chunk->signBytes = 0;
+	chunk->sections = NULL;
+	chunk->nSections = 0;
+	chunk->biomes = NULL;
+	chunk->coords = coords;
+	chunk->refs = 1;
+	chunk->bytes = 0;
+	chunk->state = CHUNK_LOADING;
+	chunk->stale = false;
+	chunk->prevUnused = chunk->nextUnused = NULL;
+	shard.index[coords] = chunk;
+	SDL_mutexV( shard.lock );
+
+	bool ok = loader->decodeChunk( *chunk );
+	size_t bytes = ok ? measureChunk( chunk ) : 0;
+
+	SDL_mutexP( shard.lock );
+	chunk->state = (unsigned char)(ok ? CHUNK_READY : CHUNK_FAILED);
+	if( ok ) {
+		chunk->bytes = bytes;
+		if( !chunk->stale ) {
+			shard.bytes += bytes;
+			trimLocked( shard );
+		}
+	} else if( !chunk->stale ) {
+		// Not cached, so the next request tries again
+		shard.index.erase( coords );
+		chunk->stale = true;
+	}
+	SDL_CondBroadcast( shard.loaded );
+	if( !ok ) {
+		releaseLocked( shard, chunk );
+		chunk = NULL;
+	}
+	SDL_mutexV( shard.lock );
+	return chunk;
+}
+
+void ChunkCache::release( Chunk *chunk ) {
+	Shard &shard = shards[shardOf( chunk->coords )];
+	SDL_mutexP( shard.lock );
+	releaseLocked( shard, chunk );
+	SDL_mutexV( shard.lock );
+}
+
+void ChunkCache::invalidate( const Coords2D &coords ) {
+	Shard &shard = shards[shardOf( coords )];
+	SDL_mutexP( shard.lock );
+
+	ChunkIndex::iterator it = shard.index.find( coords );
+	if( it != shard.index.end() )
+		dropLocked( shard, it->second );
+
+	SDL_mutexV( shard.lock );
+}
+
+void ChunkCache::invalidateAll() {
+	for( unsigned i = 0; i < SHARD_COUNT; i++ ) {
+		Shard &shard = shards[i];
+		SDL_mutexP( shard.lock );
+		while( !shard.index.empty() )
+			dropLocked( shard, shard.index.begin()->second );
+		SDL_mutexV( shard.lock );
+	}
+}
+
+void ChunkCache::setMaxBytes( size_t maxBytes ) {
+	this->maxBytes = maxBytes;
+	for( unsigned i = 0; i < SHARD_COUNT; i++ ) {
+		Shard &shard = shards[i];
+		SDL_mutexP( shard.lock );
+		shard.maxBytes = maxBytes / SHARD_COUNT;
+		trimLocked( shard );
+		SDL_mutexV( shard.lock );
+	}
+}
+
+void ChunkCache::getStats( Stats &stats ) {
+	stats.hits = stats.misses = stats.evictions = 0;
+	stats.bytesResident = 0;
+	stats.chunksResident = 0;
+	for( unsigned i = 0; i < SHARD_COUNT; i++ ) {
+		Shard &shard = shards[i];
+		SDL_mutexP( shard.lock );
+		stats.hits += shard.hits;
+		stats.misses += shard.misses;
+		stats.evictions += shard.evictions;
+		stats.bytesResident += shard.bytes;
+		stats.chunksResident += (unsigned)shard.index.size();
+		SDL_mutexV( shard.lock );
+	}
+}
+
+void ChunkCache::releaseLocked( Shard &shard, Chunk *chunk ) {
+	assert( chunk->refs > 0 );
+	if( --chunk->refs > 0 )
+		return;
+
+	if( chunk->stale ) {
+		// Already out of the index
+		freeChunk( chunk );
+		return;
+	}
+
+	// Most recently used chunks go at the tail
+	chunk->nextUnused = NULL;
+	chunk->prevUnused = shard.unusedTail;
+	if( shard.unusedTail ) {
+		shard.unusedTail->nextUnused = chunk;
+	} else {
+		shard.unusedHead = chunk;
+	}
+	shard.unusedTail = chunk;
+
+	trimLocked( shard );
+}
+
+void ChunkCache::unlinkUnused( Shard &shard, Chunk *chunk ) {
+	if( chunk->prevUnused ) {
+		chunk->prevUnused->nextUnused = chunk->nextUnused;
+	} else {
+		shard.unusedHead = chunk->nextUnused;
+	}
+	if( chunk->nextUnused ) {
+		chunk->nextUnused->prevUnused = chunk->prevUnused;
+	} else {
+		shard.unusedTail = chunk->prevUnused;
+	}
+	chunk->prevUnused = chunk->nextUnused = NULL;
+}
+
+void ChunkCache::trimLocked( Shard &shard ) {
+	while( shard.bytes > shard.maxBytes && shard.unusedHead ) {
+		dropLocked( shard, shard.unusedHead );
+		shard.evictions++;
+	}
+}
+
+void ChunkCache::dropLocked( Shard &shard, Chunk *chunk ) {
+	shard.index.erase( chunk->coords );
+	shard.bytes -= chunk->bytes;
+	chunk->stale = true;
+	if( chunk->refs == 0 ) {
+		unlinkUnused( shard, chunk );
+		freeChunk( chunk );
+	}
+}
+
+size_t ChunkCache::measureChunk( const Chunk *chunk ) {
+	size_t bytes = sizeof(Chunk) + chunk->nSections * sizeof(ChunkSection*);
+	for( unsigned i = 0; i < chunk->nSections; i++ )
+		bytes += chunk->sections[i]->getMemoryUse();
+	if( chunk->biomes )
+		bytes += 16*16*sizeof(unsigned short);
+	bytes += chunk->signBytes;
+	return bytes;
+}
+
+void ChunkCache::freeChunk( Chunk *chunk ) {
+	free( chunk->signs );
+	if( chunk->sections ) {
+		for( unsigned i = 0; i < chunk->nSections; i++ )
+			ChunkSection::destroy( chunk->sections[i] );
+		delete[] chunk->sections;
+	}
+	delete[] chunk->biomes;
+	delete chunk;
+}
@@ -0,0 +1,136 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#ifndef CHUNKCACHE_H
+#define CHUNKCACHE_H
+
+#include <map>
+#include <SDL.h>
+
+#include "chunksection.h"
+#include "mcregionmap.h"
+
+class MCMap;
+
+// Decoded chunks shared by all of the mesh workers' MCMaps
+// Chunks are reference counted; the ones nobody holds are kept in an LRU
+// list until the cache is over its memory budget. Only one thread ever
+// decodes a given chunk: others asking for it at the same time wait for it.
+class ChunkCache {
+public:
+	explicit ChunkCache( size_t maxBytes = DEFAULT_MAX_BYTES );
+	~ChunkCache();
+
+	enum { DEFAULT_MAX_BYTES = 256*1024*1024 };
+
+	struct Stats {
+		unsigned long long hits, misses, evictions;
+		size_t bytesResident;
+		unsigned chunksResident;
+	};
+
+	// A sign, copied out of the chunk's tile entities
+	struct Sign {
+		int x, y, z;
+		bool onWall;
+		unsigned char orientation;
+		unsigned short textLen[4];
+		// UTF-8, not null-terminated
+		const char *text[4];
+	};
+
+	struct Chunk {
+		// One per 16 blocks of height from minZ; sections missing from
+		// the chunk are ChunkSection::getEmpty()
+		ChunkSection **sections;
+		unsigned nSections;
+		unsigned short *biomes;
+		Coords2D coords;
+		int minZ, maxZ;
+		// The lowest and highest non-air blocks of each column, indexed as
+		// in a section; bottomZ > topZ if the column is all air
+		short bottomZ[16*16], topZ[16*16];
+		// The signs and their text share one allocation of signBytes
+		Sign *signs;
+		unsigned nSigns, signBytes;
+
+	private:
+		friend class ChunkCache;
+		unsigned refs;
+		size_t bytes;
+		unsigned char state;
+		bool stale;
+		Chunk *prevUnused, *nextUnused;
+	};
+
+	// Returns the chunk with a reference held, decoding it with loader if
+	// no other thread has
+	// Returns NULL if the chunk does not exist or cannot be decoded
+	Chunk *acquire( const Coords2D &coords, MCMap *loader );
+	void release( Chunk *chunk );
+
+	// Drops a chunk which changed on disk; holders keep their old copy
+	void invalidate( const Coords2D &coords );
+	void invalidateAll();
+
+	// Chunks in use can keep the cache over budget until they are released
+	void setMaxBytes( size_t maxBytes );
+	inline size_t getMaxBytes() const { return maxBytes; }
+	void getStats( Stats &stats );
+
+private:
+	ChunkCache( const ChunkCache& );
+	ChunkCache &operator=( const ChunkCache& );
+
+	enum { SHARD_SHIFT = 4, SHARD_COUNT = 1 << SHARD_SHIFT };
+
+	typedef std::map< Coords2D, Chunk* > ChunkIndex;
+
+	struct Shard {
+		SDL_mutex *lock;
+		SDL_cond *loaded;
+		ChunkIndex index;
+		Chunk *unusedHead, *unusedTail;
+		size_t bytes, maxBytes;
+		unsigned long long hits, misses, evictions;
+	};
+
+	static inline unsigned shardOf( const Coords2D &coords ) {
+		return (((unsigned)coords.x * 0x9e3779b1u) ^ ((unsigned)coords.y * 0x85ebca6bu)) >> (32 - SHARD_SHIFT);
+	}
+
+	void releaseLocked( Shard &shard, Chunk *chunk );
+	void unlinkUnused( Shard &shard, Chunk *chunk );
+	void trimLocked( Shard &shard );
+	void dropLocked( Shard &shard, Chunk *chunk );
+	static size_t measureChunk( const Chunk *chunk );
+	static void freeChunk( Chunk *chunk );
+
+	Shard shards[SHARD_COUNT];
+	// Each shard keeps its own copy of the budget under its lock; this one
+	// is only for the thread which sets it
+	size_t maxBytes;
+};
+
+#endif // CHUNKCACHE_H
@@ -0,0 +1,273 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include <cstdlib>
+#include <cstring>
+
+#include "chunksection.h"
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+# define CHUNKSECTION_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define CHUNKSECTION_SSE2
+#endif
+
+static const uint32_t emptyPalette[1] = { 0 };
+
+static ChunkSection makeUniformSection( const uint32_t *palette, unsigned char skyLight ) {
+	ChunkSection section;
+	section.palette = palette;
+	section.indices = NULL;
+	section.blockLight = NULL;
+	section.skyLight = NULL;
+	section.indexMask = 0;
+	section.allocSize = 0;
+	section.paletteSize = 1;
+	section.bitsShift = 0;
+	section.blockLightFill = 0;
+	section.skyLightFill = skyLight;
+	return section;
+}
+
+static ChunkSection emptySection = makeUniformSection( emptyPalette, 0xf );
+
+ChunkSection *ChunkSection::getEmpty() {
+	return &emptySection;
+}
+
+static inline unsigned get4bitsAt( const unsigned char *dat, unsigned i ) {
+	return (dat[i>>1] >> ((i&1)<<2)) & 0xfu;
+}
+
+#ifdef CHUNKSECTION_SSE2
+// Expands 8 bytes of nibbles into 16 bytes, low nibble first
+static inline __m128i unpackNibbles( const unsigned char *src ) {
+	const __m128i lowNibbles = _mm_set1_epi8( 0xf );
+	__m128i packed = _mm_loadl_epi64( (const __m128i*)src );
+	return _mm_unpacklo_epi8( _mm_and_si128( packed, lowNibbles ),
+		_mm_and_si128( _mm_srli_epi16( packed, 4 ), lowNibbles ) );
+}
+#endif
+
+static void decodeStatesFrom( const unsigned char *blocks, const unsigned char *add,
+	const unsigned char *data, uint32_t *states, unsigned i, unsigned count )
+{
+	for( ; i < count; i++ ) {
+		uint32_t id = blocks[i];
+		if( add )
+			id |= get4bitsAt( add, i ) << 8;
+		states[i] = id | (get4bitsAt( data, i ) << 16);
+	}
+}
+
+// Whole runs of 16 blocks are vectorized, the rest go through the scalar loop
+void ChunkSection::decodeStates( const unsigned char *blocks, const unsigned char *add,
+	const unsigned char *data, uint32_t *states, unsigned count )
+{
+	unsigned i = 0;
+#if defined(CHUNKSECTION_AVX2) && defined(CHUNKSECTION_SSE2)
+	for( ; i + 16 <= count; i += 16 ) {
+		__m256i id = _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*)(blocks + i) ) );
+		if( add )
+			id = _mm256_or_si256( id, _mm256_slli_epi16( _mm256_cvtepu8_epi16( unpackNibbles( add + (i>>1) ) ), 8 ) );
+		__m256i dat = _mm256_cvtepu8_epi16( unpackNibbles( data + (i>>1) ) );
+		// Interleaving works within each 128-bit lane, so swap the middle quarters back
+		__m256i lo = _mm256_unpacklo_epi16( id, dat );
+		__m256i hi = _mm256_unpackhi_epi16( id, dat );
+		_mm256_storeu_si256( (__m256i*)(states + i), _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+		_mm256_storeu_si256( (__m256i*)(states + i + 8), _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+	}
+#elif defined(CHUNKSECTION_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	for( ; i + 16 <= count; i += 16 ) {
+		__m128i id = _mm_loadu_si128( (const __m128i*)(blocks + i) );
+		__m128i idLo = _mm_unpacklo_epi8( id, zero );
+		__m128i idHi = _mm_unpackhi_epi8( id, zero );
+		if( add ) {
+			__m128i ad = unpackNibbles( add + (i>>1) );
+			idLo = _mm_or_si128( idLo, _mm_unpacklo_epi8( zero, ad ) );
+			idHi = _mm_or_si128( idHi, _mm_unpackhi_epi8( zero, ad ) );
+		}
+		__m128i dat = unpackNibbles( data + (i>>1) );
+		__m128i datLo = _mm_unpacklo_epi8( dat, zero );
+		__m128i datHi = _mm_unpackhi_epi8( dat, zero );
+		_mm_storeu_si128( (__m128i*)(states + i), _mm_unpacklo_epi16( idLo, datLo ) );
+		_mm_storeu_si128( (__m128i*)(states + i + 4), _mm_unpackhi_epi16( idLo, datLo ) );
+		_mm_storeu_si128( (__m128i*)(states + i + 8), _mm_unpacklo_epi16( idHi, datHi ) );
+		_mm_storeu_si128( (__m128i*)(states + i + 12), _mm_unpackhi_epi16( idHi, datHi ) );
+	}
+#endif
+	decodeStatesFrom( blocks, add, data, states, i, count );
+}
+
+void ChunkSection::decodeStatesScalar( const unsigned char *blocks, const unsigned char *add,
+	const unsigned char *data, uint32_t *states, unsigned count )
+{
+	decodeStatesFrom( blocks, add, data, states, 0, count );
+}
+
+static bool isUniformNibbles( const unsigned char *nibbles, unsigned char &fill ) {
+	unsigned char b = nibbles[0];
+	if( (b >> 4) != (b & 0xf) )
+		return false;
+	unsigned i = 0;
+#ifdef CHUNKSECTION_SSE2
+	const __m128i splat = _mm_set1_epi8( (char)b );
+	for( ; i < ChunkSection::BLOCKS/2; i += 16 ) {
+		__m128i eq = _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)(nibbles + i) ), splat );
+		if( _mm_movemask_epi8( eq ) != 0xffff )
+			return false;
+	}
+#endif
+	for( ; i < ChunkSection::BLOCKS/2; i++ ) {
+		if( nibbles[i] != b )
+			return false;
+	}
+	fill = b & 0xf;
+	return true;
+}
+
+ChunkSection::BuildScratch::BuildScratch() {
+	memset( hashKeys, 0xff, sizeof(hashKeys) );
+}
+
+static inline unsigned hashState( uint32_t state ) {
+	return (state * 0x9e3779b1u) >> (32 - ChunkSection::BuildScratch::HASH_SHIFT);
+}
+
+ChunkSection *ChunkSection::build( const uint32_t *states,
+	const unsigned char *blockLight, const unsigned char *skyLight, BuildScratch &scratch )
+{
+	// Find the distinct states
+	const unsigned HASH_MASK = BuildScratch::HASH_SIZE - 1;
+	uint32_t *hashKeys = scratch.hashKeys;
+	unsigned short *hashValues = scratch.hashValues;
+	uint32_t *palette = scratch.palette;
+	unsigned short *paletteIdx = scratch.paletteIdx;
+
+	unsigned paletteSize = 0;
+	uint32_t lastState = 0xffffffffu;
+	unsigned short lastIdx = 0;
+	for( unsigned i = 0; i < BLOCKS; i++ ) {
+		uint32_t state = states[i];
+		if( state != lastState ) {
+			unsigned h = hashState( state );
+			while( hashKeys[h] != state && hashKeys[h] != 0xffffffffu )
+				h = (h + 1) & HASH_MASK;
+			if( hashKeys[h] == 0xffffffffu ) {
+				hashKeys[h] = state;
+				hashValues[h] = (unsigned short)paletteSize;
+				palette[paletteSize++] = state;
+			}
+			lastState = state;
+			lastIdx = hashValues[h];
+		}
+		paletteIdx[i] = lastIdx;
+	}
+
+	// Empty the table again, newest first, so that the slots probed past
+	// to reach each state are still filled when it is looked up
+	for( unsigned i = paletteSize; i-- > 0; ) {
+		unsigned h = hashState( palette[i] );
+		while( hashKeys[h] != palette[i] )
+			h = (h + 1) & HASH_MASK;
+		hashKeys[h] = 0xffffffffu;
+	}
+
+	unsigned bitsShift = 0;
+	while( paletteSize > (1u << (1u << bitsShift)) )
+		bitsShift++;
+
+	unsigned char blockLightFill = 0, skyLightFill = 0;
+	bool blockLightUniform = isUniformNibbles( blockLight, blockLightFill );
+	bool skyLightUniform = isUniformNibbles( skyLight, skyLightFill );
+
+	// Everything lives in a single allocation after the header
+	size_t paletteBytes = ((paletteSize * sizeof(uint32_t)) + 7) & ~(size_t)7;
+	size_t indexBytes = paletteSize > 1 ? (BLOCKS / 8) << bitsShift : 0;
+	size_t size = sizeof(ChunkSection) + paletteBytes + indexBytes;
+	if( !blockLightUniform )
+		size += BLOCKS/2;
+	if( !skyLightUniform )
+		size += BLOCKS/2;
+
+	unsigned char *mem = (unsigned char*)malloc( size );
+	if( !mem )
+		return NULL;
+	ChunkSection *section = (ChunkSection*)mem;
+	mem += sizeof(ChunkSection);
+
+	uint32_t *sectionPalette = (uint32_t*)mem;
+	memcpy( sectionPalette, palette, paletteSize * sizeof(uint32_t) );
+	section->palette = sectionPalette;
+	mem += paletteBytes;
+
+	if( indexBytes ) {
+		uint64_t *indices = (uint64_t*)mem;
+		unsigned perWordShift = 6 - bitsShift;
+		unsigned perWord = 1u << perWordShift;
+		for( unsigned w = 0; w < ((unsigned)BLOCKS >> perWordShift); w++ ) {
+			uint64_t word = 0;
+			const unsigned short *src = &paletteIdx[w << perWordShift];
+			for( unsigned j = 0; j < perWord; j++ )
+				word |= (uint64_t)src[j] << (j << bitsShift);
+			indices[w] = word;
+		}
+		section->indices = indices;
+		mem += indexBytes;
+	} else {
+		section->indices = NULL;
+	}
+
+	if( blockLightUniform ) {
+		section->blockLight = NULL;
+	} else {
+		memcpy( mem, blockLight, BLOCKS/2 );
+		section->blockLight = mem;
+		mem += BLOCKS/2;
+	}
+	if( skyLightUniform ) {
+		section->skyLight = NULL;
+	} else {
+		memcpy( mem, skyLight, BLOCKS/2 );
+		section->skyLight = mem;
+		mem += BLOCKS/2;
+	}
+
+	section->indexMask = (1u << (1u << bitsShift)) - 1;
+	section->allocSize = (unsigned)size;
+	section->paletteSize = (unsigned short)paletteSize;
+	section->bitsShift = (unsigned char)bitsShift;
+	section->blockLightFill = blockLightFill;
+	section->skyLightFill = skyLightFill;
+	return section;
+}
+
+void ChunkSection::destroy( ChunkSection *section ) {
+	if( section != getEmpty() )
+		free( section );
+}
@@ -0,0 +1,91 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#ifndef CHUNKSECTION_H
+#define CHUNKSECTION_H
+
+#include "stdint.h"
+
+// A 16x16x16 block section in compact form
+// Block ids and data are combined into states (id | data << 16), which
+// are stored as bit-packed indices into a palette. Blocks are ordered as
+// in an Anvil section: index = (height << 8) | (mcZ << 4) | mcX.
+struct ChunkSection {
+	enum { BLOCKS = 16*16*16 };
+
+	inline unsigned getState( unsigned i ) const {
+		if( !indices )
+			return palette[0];
+		unsigned perWordShift = 6 - bitsShift;
+		uint64_t word = indices[i >> perWordShift];
+		unsigned shift = (i & ((1u << perWordShift) - 1)) << bitsShift;
+		return palette[(unsigned)(word >> shift) & indexMask];
+	}
+	inline unsigned getBlockLight( unsigned i ) const
+		{ return blockLight ? (blockLight[i>>1] >> ((i&1)<<2)) & 0xfu : blockLightFill; }
+	inline unsigned getSkyLight( unsigned i ) const
+		{ return skyLight ? (skyLight[i>>1] >> ((i&1)<<2)) & 0xfu : skyLightFill; }
+	inline unsigned getMemoryUse() const { return allocSize; }
+	inline bool isAir() const { return !indices && (palette[0] & 0xffffu) == 0; }
+
+	// Combines the first count blocks of an Anvil section's Blocks, Add
+	// (which may be NULL) and Data arrays into states
+	static void decodeStates( const unsigned char *blocks, const unsigned char *add,
+		const unsigned char *data, uint32_t *states, unsigned count = BLOCKS );
+	// The plain loop decodeStates finishes with; test/decodestates.cpp
+	// checks the vectorized paths against it
+	static void decodeStatesScalar( const unsigned char *blocks, const unsigned char *add,
+		const unsigned char *data, uint32_t *states, unsigned count = BLOCKS );
+	// Working space for build, kept by each thread which builds sections
+	// The hash table is left empty after each build, so it is only cleared
+	// once rather than on every call
+	struct BuildScratch {
+		BuildScratch();
+		enum { HASH_SHIFT = 13, HASH_SIZE = 1 << HASH_SHIFT };
+		uint32_t hashKeys[HASH_SIZE]; // 0xffffffff if the slot is empty
+		unsigned short hashValues[HASH_SIZE];
+		uint32_t palette[BLOCKS];
+		unsigned short paletteIdx[BLOCKS];
+	};
+	// Packs full arrays, laid out as in an Anvil section, into a new section
+	// The lights are nibbles
+	static ChunkSection *build( const uint32_t *states,
+		const unsigned char *blockLight, const unsigned char *skyLight, BuildScratch &scratch );
+	static void destroy( ChunkSection *section );
+
+	// A shared section of air in full sunlight which is never destroyed
+	static ChunkSection *getEmpty();
+
+	const uint32_t *palette;
+	const uint64_t *indices; // NULL if every block is palette[0]
+	const unsigned char *blockLight; // NULL if every nibble is blockLightFill
+	const unsigned char *skyLight; // NULL if every nibble is skyLightFill
+	unsigned indexMask;
+	unsigned allocSize;
+	unsigned short paletteSize;
+	unsigned char bitsShift; // log2 of the bits per index
+	unsigned char blockLightFill, skyLightFill;
+};
+
+#endif // CHUNKSECTION_H
@@ -0,0 +1,350 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include <zlib.h>
+#include <cstdlib>
+#include <cstring>
+#include <SDL_atomic.h>
+#include <SDL_thread.h>
+
+#ifdef EIHORT_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "decompress.h"
+#include "stdint.h"
+
+// Chunks rarely compress better than this
+#define INITIAL_RATIO 8
+// Anything larger is treated as corrupt
+#define MAX_DECOMPRESSED_SIZE (256u*1024u*1024u)
+
+ScratchBuffer::~ScratchBuffer() {
+	free( data );
+}
+
+bool ScratchBuffer::reserve( size_t n ) {
+	if( n <= capacity )
+		return true;
+	size_t newCapacity = capacity ? capacity : 4096;
+	while( newCapacity < n )
+		newCapacity <<= 1;
+	unsigned char *newData = (unsigned char*)realloc( data, newCapacity );
+	if( !newData )
+		return false;
+	data = newData;
+	capacity = newCapacity;
+	return true;
+}
+
+struct ThreadContext {
+	ThreadContext() : zInitialized(false) {
+#ifdef EIHORT_LIBDEFLATE
+		deflater = libdeflate_alloc_decompressor();
+#endif
+	}
+	~ThreadContext() {
+		if( zInitialized )
+			inflateEnd( &zs );
+#ifdef EIHORT_LIBDEFLATE
+		libdeflate_free_decompressor( deflater );
+#endif
+	}
+
+	ScratchBuffer scratch;
+	z_stream zs;
+	bool zInitialized;
+#ifdef EIHORT_LIBDEFLATE
+	libdeflate_decompressor *deflater;
+#endif
+};
+
+static SDL_TLSID threadContextId = 0;
+static SDL_SpinLock threadContextLock = 0;
+
+static void destroyThreadContext( void *ctx ) {
+	delete static_cast<ThreadContext*>( ctx );
+}
+
+static ThreadContext *getThreadContext() {
+	SDL_AtomicLock( &threadContextLock );
+	if( !threadContextId )
+		threadContextId = SDL_TLSCreate();
+	SDL_AtomicUnlock( &threadContextLock );
+
+	ThreadContext *ctx = static_cast<ThreadContext*>( SDL_TLSGet( threadContextId ) );
+	if( !ctx ) {
+		ctx = new ThreadContext;
+		SDL_TLSSet( threadContextId, ctx, &destroyThreadContext );
+	}
+	return ctx;
+}
+
+ScratchBuffer *getThreadScratch() {
+	return &getThreadContext()->scratch;
+}
+
+ScratchBuffer *borrowScratch( bool &owned ) {
+	ScratchBuffer *scratch = getThreadScratch();
+	owned = scratch->inUse;
+	if( owned )
+		return new ScratchBuffer;
+	scratch->inUse = true;
+	return scratch;
+}
+
+void releaseScratch( ScratchBuffer *buffer, bool owned ) {
+	if( owned )
+		delete buffer;
+	else
+		buffer->inUse = false;
+}
+
+#ifdef EIHORT_LIBDEFLATE
+
+typedef enum libdeflate_result (*LibdeflateFunc)( libdeflate_decompressor*, const void*, size_t, void*, size_t, size_t* );
+
+static bool decompressLibdeflate( LibdeflateFunc func, const void *src, size_t len, ScratchBuffer *out ) {
+	libdeflate_decompressor *deflater = getThreadContext()->deflater;
+	if( !out->reserve( len * INITIAL_RATIO ) )
+		return false;
+
+	while( true ) {
+		enum libdeflate_result res = func( deflater, src, len, out->data, out->capacity, &out->size );
+		if( res == LIBDEFLATE_SUCCESS )
+			return true;
+		if( res != LIBDEFLATE_INSUFFICIENT_SPACE || out->capacity >= MAX_DECOMPRESSED_SIZE )
+			return false;
+		if( !out->reserve( out->capacity * 2 ) )
+			return false;
+	}
+}
+
+static bool decompressGzip( const void *src, size_t len, ScratchBuffer *out ) {
+	return decompressLibdeflate( &libdeflate_gzip_decompress, src, len, out );
+}
+
+static bool decompressZlib( const void *src, size_t len, ScratchBuffer *out ) {
+	return decompressLibdeflate( &libdeflate_zlib_decompress, src, len, out );
+}
+
+#else
+
+static bool decompressZStream( const void *src, size_t len, ScratchBuffer *out ) {
+	ThreadContext *ctx = getThreadContext();
+	z_stream &zs = ctx->zs;
+	if( ctx->zInitialized ) {
+		inflateReset( &zs );
+	} else {
+		memset( &zs, 0, sizeof(zs) );
+		// Accept both zlib and gzip headers
+		if( inflateInit2( &zs, 15 + 32 ) != Z_OK )
+			return false;
+		ctx->zInitialized = true;
+	}
+
+	if( !out->reserve( len * INITIAL_RATIO ) )
+		return false;
+	out->size = 0;
+	zs.next_in = (Bytef*)src;
+	zs.avail_in = (uInt)len;
+
+	while( true ) {
+		if( out->size == out->capacity ) {
+			if( out->capacity >= MAX_DECOMPRESSED_SIZE || !out->reserve( out->capacity * 2 ) )
+				return false;
+		}
+		zs.next_out = out->data + out->size;
+		zs.avail_out = (uInt)(out->capacity - out->size);
+		int ret = inflate( &zs, Z_NO_FLUSH );
+		out->size = out->capacity - zs.avail_out;
+
+		if( ret == Z_STREAM_END )
+			return true;
+		if( ret != Z_OK && ret != Z_BUF_ERROR )
+			return false;
+		if( zs.avail_in == 0 && zs.avail_out != 0 )
+			return false; // Truncated
+	}
+}
+
+static bool decompressGzip( const void *src, size_t len, ScratchBuffer *out ) {
+	return decompressZStream( src, len, out );
+}
+
+static bool decompressZlib( const void *src, size_t len, ScratchBuffer *out ) {
+	return decompressZStream( src, len, out );
+}
+
+#endif
+
+static bool decompressNone( const void *src, size_t len, ScratchBuffer *out ) {
+	if( !out->reserve( len ) )
+		return false;
+	memcpy( out->data, src, len );
+	out->size = len;
+	return true;
+}
+
+static inline uint32_t readLE32( const unsigned char *p ) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Decodes one raw LZ4 block into dest, which must be exactly destLen bytes
+static bool decodeLZ4Block( const unsigned char *src, size_t srcLen, unsigned char *dest, size_t destLen ) {
+	const unsigned char *ip = src, *iend = src + srcLen;
+	unsigned char *op = dest, *oend = dest + destLen;
+
+	while( ip < iend ) {
+		unsigned token = *ip++;
+
+		size_t litLen = token >> 4;
+		if( litLen == 15 ) {
+			unsigned b;
+			do {
+				if( ip >= iend )
+					return false;
+				b = *ip++;
+				litLen += b;
+			} while( b == 255 );
+		}
+		if( litLen > (size_t)(iend - ip) || litLen > (size_t)(oend - op) )
+			return false;
+		memcpy( op, ip, litLen );
+		ip += litLen;
+		op += litLen;
+
+		if( ip >= iend )
+			break; // The last sequence has no match
+
+		if( iend - ip < 2 )
+			return false;
+		size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		if( offset == 0 || offset > (size_t)(op - dest) )
+			return false;
+
+		size_t matchLen = token & 15;
+		if( matchLen == 15 ) {
+			unsigned b;
+			do {
+				if( ip >= iend )
+					return false;
+				b = *ip++;
+				matchLen += b;
+			} while( b == 255 );
+		}
+		matchLen += 4;
+		if( matchLen > (size_t)(oend - op) )
+			return false;
+
+		const unsigned char *match = op - offset;
+		if( offset >= matchLen ) {
+			memcpy( op, match, matchLen );
+			op += matchLen;
+		} else {
+			// Overlapping copy repeats the last offset bytes
+			for( size_t i = 0; i < matchLen; i++ )
+				*op++ = *match++;
+		}
+	}
+
+	return op == oend;
+}
+
+// Minecraft stores LZ4 chunks in the block stream format of lz4-java:
+// "LZ4Block", a method/level token, then the little-endian compressed length,
+// decompressed length and checksum, then the data. A zero-length block ends it.
+static bool decompressLZ4( const void *src, size_t len, ScratchBuffer *out ) {
+	const unsigned char *ip = (const unsigned char*)src, *iend = ip + len;
+	const size_t HEADER_SIZE = 8 + 1 + 4 + 4 + 4;
+
+	out->size = 0;
+	while( (size_t)(iend - ip) >= HEADER_SIZE ) {
+		if( memcmp( ip, "LZ4Block", 8 ) != 0 )
+			return false;
+		unsigned method = ip[8] & 0xf0;
+		size_t compressedLen = readLE32( ip + 9 );
+		size_t decompressedLen = readLE32( ip + 13 );
+		ip += HEADER_SIZE;
+
+		if( decompressedLen == 0 )
+			return true;
+		if( compressedLen > (size_t)(iend - ip) || out->size + decompressedLen > MAX_DECOMPRESSED_SIZE )
+			return false;
+		if( !out->reserve( out->size + decompressedLen ) )
+			return false;
+
+		unsigned char *dest = out->data + out->size;
+		if( method == 0x10 ) {
+			// Stored
+			if( compressedLen != decompressedLen )
+				return false;
+			memcpy( dest, ip, decompressedLen );
+		} else if( method == 0x20 ) {
+			if( !decodeLZ4Block( ip, compressedLen, dest, decompressedLen ) )
+				return false;
+		} else {
+			return false;
+		}
+		out->size += decompressedLen;
+		ip += compressedLen;
+	}
+
+	// Accept streams which were cut off after a complete block
+	return out->size != 0;
+}
+
+static Decompressor decompressors[COMPRESSION_COUNT] = {
+	NULL,
+	&decompressGzip,
+	&decompressZlib,
+	&decompressNone,
+	&decompressLZ4
+};
+
+void setDecompressor( CompressionType type, Decompressor decompressor ) {
+	decompressors[type] = decompressor;
+}
+
+bool decompress( CompressionType type, const void *src, size_t len, ScratchBuffer *out ) {
+	if( type <= 0 || type >= COMPRESSION_COUNT || !decompressors[type] ) {
+		out->size = 0;
+		return false;
+	}
+	return decompressors[type]( src, len, out );
+}
+
+bool decompressRegionChunk( const void *chunkData, size_t available, ScratchBuffer *out ) {
+	out->size = 0;
+	if( available < 5 )
+		return false;
+	const unsigned char *src = (const unsigned char*)chunkData;
+	uint32_t len = ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | (uint32_t)src[3];
+	if( len < 1 || len > available - 4 )
+		return false;
+
+	// Chunks stored outside of the region have no data here
+	return decompress( (CompressionType)src[4], src + 5, len-1, out );
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <cstddef>
+
+// Growable buffer which keeps its memory between uses
+class ScratchBuffer {
+public:
+	ScratchBuffer() : data(NULL), size(0), capacity(0), inUse(false) { }
+	~ScratchBuffer();
+
+	// Grows the buffer to hold at least n bytes, keeping its contents
+	bool reserve( size_t n );
+
+	unsigned char *data;
+	size_t size;
+	size_t capacity;
+	// Set while the buffer is lent out by borrowScratch
+	bool inUse;
+
+private:
+	ScratchBuffer( const ScratchBuffer& );
+	ScratchBuffer &operator=( const ScratchBuffer& );
+};
+
+// Values match the compression byte in front of region file chunks
+enum CompressionType {
+	COMPRESSION_GZIP = 1,
+	COMPRESSION_ZLIB = 2,
+	COMPRESSION_NONE = 3,
+	COMPRESSION_LZ4 = 4,
+	COMPRESSION_COUNT
+};
+
+// Set in the compression byte when the chunk is stored in its own file
+#define COMPRESSION_EXTERNAL 0x80
+
+// Decompresses the whole of src into out->data[0..out->size)
+typedef bool (*Decompressor)( const void *src, size_t len, ScratchBuffer *out );
+
+// Replaces the backend used for one type of compressed data
+void setDecompressor( CompressionType type, Decompressor decompressor );
+bool decompress( CompressionType type, const void *src, size_t len, ScratchBuffer *out );
+// Decompresses a chunk stored in a region file, starting at its length field
+bool decompressRegionChunk( const void *chunkData, size_t available, ScratchBuffer *out );
+
+// Scratch space private to the calling thread
+// Its contents are replaced by the next decompression into it
+ScratchBuffer *getThreadScratch();
+// Lends out the thread's scratch buffer, or a new buffer if something
+// on this thread still holds it; owned is set in that case
+ScratchBuffer *borrowScratch( bool &owned );
+// Gives back a buffer from borrowScratch, deleting it if owned
+void releaseScratch( ScratchBuffer *buffer, bool owned );
+
+#endif // DECOMPRESS_H
@@ -24,8 +24,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #ifndef ENDIAN_H_
 #define ENDIAN_H_
 
+#include <cstddef>
 #include "SDL.h"
 
+#if defined(__AVX2__)
+# include <immintrin.h>
+# define ENDIAN_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define ENDIAN_SSE2
+#endif
+
 namespace {
 
   // Swap BE <-> LE
@@ -88,6 +98,92 @@ T
 bswap_to_big(T x)
 { return bswap_from_big(x); }
 
+  // Swap arrays in place
+
+inline static
+void
+bswap_array(uint32_t *v, size_t n)
+{
+  size_t i = 0;
+#ifdef ENDIAN_AVX2
+  const __m256i mask = _mm256_setr_epi8(
+    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  for( ; i + 8 <= n; i += 8 ) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(v + i));
+    _mm256_storeu_si256((__m256i*)(v + i), _mm256_shuffle_epi8(x, mask));
+  }
+#endif
+#ifdef ENDIAN_SSE2
+  for( ; i + 4 <= n; i += 4 ) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(v + i));
+    // Swap the bytes of each word, then the words of each dword
+    x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128((__m128i*)(v + i), x);
+  }
+#endif
+  for( ; i < n; i++ )
+    v[i] = bswap(v[i]);
+}
+
+inline static
+void
+bswap_array(uint64_t *v, size_t n)
+{
+  size_t i = 0;
+#ifdef ENDIAN_AVX2
+  const __m256i mask = _mm256_setr_epi8(
+    7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+    7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  for( ; i + 4 <= n; i += 4 ) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(v + i));
+    _mm256_storeu_si256((__m256i*)(v + i), _mm256_shuffle_epi8(x, mask));
+  }
+#endif
+#ifdef ENDIAN_SSE2
+  for( ; i + 2 <= n; i += 2 ) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(v + i));
+    // Swap the bytes of each word, then reverse the words of each qword
+    x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+    x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+    _mm_storeu_si128((__m128i*)(v + i), x);
+  }
+#endif
+  for( ; i < n; i++ )
+    v[i] = bswap(v[i]);
+}
+
+inline static
+void
+bswap_array(int32_t *v, size_t n)
+{ bswap_array((uint32_t*)v, n); }
+
+inline static
+void
+bswap_array(int64_t *v, size_t n)
+{ bswap_array((uint64_t*)v, n); }
+
+template<class T>
+inline static
+void
+bswap_array_from_big(T *v, size_t n)
+{
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+  bswap_array(v, n);
+#else
+  (void)v; (void)n;
+#endif
+}
+
+template<class T>
+inline static
+void
+bswap_array_to_big(T *v, size_t n)
+{ bswap_array_from_big(v, n); }
+
 } // <anonymous>
 
 #endif // ENDIAN_H_
@@ -26,6 +26,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #define FINDFILE_H_
 
 #include "platform.h"
+#include "stdint.h"
 
 # ifdef _WINDOWS
   // Windows
@@ -57,6 +58,16 @@ namespace {
     inline const char *filename() const
     { return handle_ != INVALID_HANDLE_VALUE ? data_.cFileName : NULL; }
 
+    // Last write time and size, to tell whether the file changed
+    bool stamp(uint64_t &mtime, uint64_t &size) const
+    {
+      if (handle_ == INVALID_HANDLE_VALUE)
+        return false;
+      mtime = ((uint64_t)data_.ftLastWriteTime.dwHighDateTime << 32) | data_.ftLastWriteTime.dwLowDateTime;
+      size = ((uint64_t)data_.nFileSizeHigh << 32) | data_.nFileSizeLow;
+      return true;
+    }
+
     inline const char *next()
     {
       if (FindNextFileA(handle_, &data_) != FALSE)
@@ -119,6 +130,17 @@ namespace {
       return false;
     }
 
+    // Last write time and size, to tell whether the file changed
+    bool stamp(uint64_t &mtime, uint64_t &size) const
+    {
+      struct stat statbuf;
+      if (fullname() == NULL || stat(fullname(), &statbuf) != 0)
+        return false;
+      mtime = (uint64_t)statbuf.st_mtime;
+      size = (uint64_t)statbuf.st_size;
+      return true;
+    }
+
     inline const char *filename()
     {
       const char *result = fullname();
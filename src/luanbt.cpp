@@ -30,18 +30,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "luanbt.h"
 #include "nbt.h"
 
-static void wchartochar( const wchar_t *in, char *out ) {
-	do {
-		*(out++) = *in <= 0xff ? (char)*in : '?';
-	} while( *(in++) );
-}
-
-static void chartowchar( const char *in, wchar_t *out ) {
-	do {
-		*(out++) = *in;
-	} while( *(in++) );
-}
-
 static nbt::TagType stringToTagType( const char *name ) {
 	switch( *name ) {
 		case 'b':
@@ -94,6 +82,8 @@ static const char *tagTypeToString( nbt::TagType type ) {
 	case nbt::TAG_String: return "string";
 	case nbt::TAG_List: return "list";
 	case nbt::TAG_Compound: return "compound";
+	case nbt::TAG_Int_Array: return "intarray";
+	case nbt::TAG_Long_Array: return "longarray";
 	default:
 		return "unknown";
 	}
@@ -129,8 +119,7 @@ static void luaGetTagData( lua_State *L, nbt::Tag &tag, int idx ) {
 	case nbt::TAG_String: {
 		size_t len;
 		const char *s = luaL_checklstring( L, idx, &len );
-		tag.data.str = new std::wstring( len, ' ' );
-		chartowchar( s, &(*tag.data.str)[0] );
+		tag.data.str = new std::string( s, len );
 		break; }
 	case nbt::TAG_List:
 		tag.data.list = *(nbt::List**)luaL_checkudata( L, idx, LUANBTLIST_META );
@@ -152,12 +141,7 @@ static void luaPushTagData( lua_State *L, const nbt::Tag &tag ) {
 	case nbt::TAG_Double: lua_pushnumber( L, tag.data.d ); return;
 	case nbt::TAG_Long: lua_pushnumber( L, (lua_Number)tag.data.l ); return;
 	case nbt::TAG_Byte_Array: lua_pushlstring( L, (char*)tag.data.bytes, tag.extra ); return;
-	case nbt::TAG_String: {
-		char *s = new char[tag.data.str->length()+1];
-		wchartochar( tag.data.str->c_str(), s );
-		lua_pushstring( L, s );
-		delete[] s;
-		return; }
+	case nbt::TAG_String: lua_pushlstring( L, tag.data.str->data(), tag.data.str->length() ); return;
 	case nbt::TAG_List:
 		*(nbt::List**)lua_newuserdata( L, sizeof(nbt::List*) ) = tag.data.list;
 		luaL_newmetatable( L, LUANBTLIST_META );
@@ -178,9 +162,7 @@ static int luaNBTCompGet( lua_State *L ) {
 	nbt::Compound *comp = *(nbt::Compound**)luaL_checkudata( L, 1, LUANBTCOMPOUND_META );
 	size_t len;
 	const char *name = luaL_checklstring( L, 2, &len );
-	std::wstring wname( len, ' ' );
-	chartowchar( name, &wname[0] );
-	nbt::Compound::const_iterator it = comp->find( wname );
+	nbt::Compound::const_iterator it = comp->find( std::string( name, len ) );
 	if( it != comp->end() ) {
 		luaPushTagData( L, it->second );
 		lua_pushstring( L, tagTypeToString( it->second.type ) );
@@ -200,9 +182,7 @@ static int luaNBTCompSet( lua_State *L ) {
 
 	luaGetTagData( L, tag, 3 );
 
-	std::wstring wname( namelen, ' ' );
-	chartowchar( name, &wname[0] );
-	comp->replaceTag( wname, tag );
+	comp->replaceTag( std::string( name, namelen ), tag );
 	return 0;
 }
 
@@ -210,14 +190,12 @@ static int luaNBTCompNewCompound( lua_State *L ) {
 	nbt::Compound *comp = *(nbt::Compound**)luaL_checkudata( L, 1, LUANBTCOMPOUND_META );
 	size_t namelen;
 	const char *name = luaL_checklstring( L, 2, &namelen );
-	std::wstring wname( namelen, ' ' );
-	chartowchar( name, &wname[0] );
 
 	nbt::Compound *newComp = new nbt::Compound;
 	nbt::Tag tag;
 	tag.type = nbt::TAG_Compound;
 	tag.data.comp = newComp;
-	comp->replaceTag( wname, tag );
+	comp->replaceTag( std::string( name, namelen ), tag );
 
 	*(nbt::Compound**)lua_newuserdata( L, sizeof(nbt::Compound*) ) = newComp;
 	luaL_newmetatable( L, LUANBTCOMPOUND_META );
@@ -232,14 +210,12 @@ static int luaNBTCompNewList( lua_State *L ) {
 	nbt::TagType type = stringToTagType( luaL_checkstring( L, 3 ) );
 	luaL_argcheck( L, type != nbt::TAG_Count, 3, "Not a valid NBT type" );
 	luaL_argcheck( L, type != nbt::TAG_Byte_Array, 3, "Array of byte arrays is not allowed" );
-	std::wstring wname( namelen, ' ' );
-	chartowchar( name, &wname[0] );
 
 	nbt::List *newList = new nbt::List( type );
 	nbt::Tag tag;
 	tag.type = nbt::TAG_List;
 	tag.data.list = newList;
-	comp->replaceTag( wname, tag );
+	comp->replaceTag( std::string( name, namelen ), tag );
 
 	*(nbt::List**)lua_newuserdata( L, sizeof(nbt::List*) ) = newList;
 	luaL_newmetatable( L, LUANBTLIST_META );
@@ -256,17 +232,13 @@ static int luaNBTIterateNext( lua_State *L ) {
 		it = comp->begin();
 	} else {
 		const char *name = luaL_checklstring( L, 2, &len );
-		std::wstring wname( len, ' ' );
-		chartowchar( name, &wname[0] );
-		it = comp->find( wname );
+		it = comp->find( std::string( name, len ) );
 	}
 
 	if( it == comp->end() )
 		return 0;
 
-	std::string name( it->first.length(), ' ' );
-	wchartochar( it->first.c_str(), &name[0] );
-	lua_pushlstring( L, name.c_str(), (int)it->first.length() );
+	lua_pushlstring( L, it->first.data(), it->first.length() );
 	luaPushTagData( L, it->second );
 	lua_pushstring( L, tagTypeToString( it->second.type ) );
 	return 3;
@@ -284,9 +256,7 @@ static int luaNBTCompWrite( lua_State *L ) {
 	const char *path = luaL_checkstring( L, 2 );
 	size_t onamelen;
 	const char *oname = luaL_checklstring( L, 3, &onamelen );
-	std::wstring outerName( onamelen, ' ' );
-	chartowchar( oname, &outerName[0] );
-	comp->write( path, outerName );
+	comp->write( path, std::string( oname, onamelen ) );
 	return 0;
 }
 
@@ -367,13 +337,10 @@ static int luaNBTListLen( lua_State *L ) {
 
 static int luaLoadNBT( lua_State *L ) {
 	const char *path = luaL_checkstring( L, 1 );
-	std::wstring outerName;
+	std::string outerName;
 	nbt::Compound *comp = nbt::readNBT( path, &outerName );
 	if( comp ) {
-		char *outerName_char = new char[outerName.length()+1];
-		wchartochar( outerName.c_str(), outerName_char );
-		lua_pushstring( L, outerName_char );
-		delete[] outerName_char;
+		lua_pushlstring( L, outerName.data(), outerName.length() );
 
 		nbt::Compound **pComp = (nbt::Compound**)lua_newuserdata( L, sizeof(nbt::Compound*) );
 		*pComp = comp;
@@ -0,0 +1,147 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include <algorithm>
+
+#include "mappedfile.h"
+
+#ifndef _WINDOWS
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+: data(NULL), size(0)
+#ifdef _WINDOWS
+, file(INVALID_HANDLE_VALUE), mapping(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WINDOWS
+
+bool MappedFile::open( const char *filename ) {
+	close();
+
+	file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( file == INVALID_HANDLE_VALUE )
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if( !GetFileSizeEx( file, &fileSize ) || fileSize.QuadPart == 0 ) {
+		close();
+		return false;
+	}
+
+	mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if( !mapping ) {
+		close();
+		return false;
+	}
+
+	data = (const unsigned char*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if( !data ) {
+		close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::willNeed( size_t offset, size_t len ) const {
+#if _WIN32_WINNT >= 0x0602
+	if( offset >= size )
+		return;
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<unsigned char*>(data) + offset;
+	range.NumberOfBytes = std::min( len, size - offset );
+	PrefetchVirtualMemory( GetCurrentProcess(), 1, &range, 0 );
+#else
+	(void)offset;
+	(void)len;
+#endif
+}
+
+void MappedFile::close() {
+	if( data )
+		UnmapViewOfFile( data );
+	if( mapping )
+		CloseHandle( mapping );
+	if( file != INVALID_HANDLE_VALUE )
+		CloseHandle( file );
+	data = NULL;
+	size = 0;
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool MappedFile::open( const char *filename ) {
+	close();
+
+	int fd = ::open( filename, O_RDONLY );
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat( fd, &st ) != 0 || st.st_size == 0 ) {
+		::close( fd );
+		return false;
+	}
+
+	// The mapping stays valid after the descriptor is closed
+	void *view = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	::close( fd );
+	if( view == MAP_FAILED )
+		return false;
+
+	data = (const unsigned char*)view;
+	size = (size_t)st.st_size;
+	return true;
+}
+
+void MappedFile::willNeed( size_t offset, size_t len ) const {
+	if( offset >= size )
+		return;
+	len = std::min( len, size - offset );
+	size_t start = offset & ~((size_t)sysconf( _SC_PAGESIZE ) - 1);
+	madvise( const_cast<unsigned char*>(data) + start, len + offset - start, MADV_WILLNEED );
+}
+
+void MappedFile::close() {
+	if( data )
+		munmap( const_cast<unsigned char*>(data), size );
+	data = NULL;
+	size = 0;
+}
+
+#endif
@@ -43,6 +43,8 @@ public:
 
 	inline unsigned shouldHighlight( unsigned id ) const { return blockFlags[id] & 0x80u; }
 	inline unsigned getSolidity( unsigned id, unsigned dir ) const { return blockFlags[id] & (1u<<dir); }
+	// Solidity in bits 0-5, highlighting in bit 7
+	inline unsigned getFlags( unsigned id ) const { return blockFlags[id]; }
 	inline mcgeom::BlockGeometry *getGeometry( unsigned id ) const { return geometry[id]; }
 	inline bool enableBlockLighting() const { return blockLighting; }
 
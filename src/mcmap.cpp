@@ -24,19 +24,65 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include <string>
 #include <cassert>
+#include <cstdlib>
 
 #include "mcmap.h"
 
-MCMap::MCMap( MCRegionMap *regions )
+static const unsigned char *getByteArray( const nbt::Value *comp, nbt::Atom name, unsigned minSize ) {
+	const nbt::Value *arr = comp->get( name, nbt::TAG_Byte_Array );
+	return arr && arr->size() >= minSize ? arr->bytes : NULL;
+}
+
+static const nbt::Schema signSchema[] = {
+	{ "id", NULL }, { "x", NULL }, { "y", NULL }, { "z", NULL },
+	{ "Text1", NULL }, { "Text2", NULL }, { "Text3", NULL }, { "Text4", NULL },
+	{ NULL, NULL }
+};
+
+static const nbt::Schema mcregionLevelSchema[] = {
+	{ "Blocks", NULL }, { "BlockLight", NULL }, { "SkyLight", NULL }, { "Data", NULL },
+	{ "TileEntities", signSchema },
+	{ NULL, NULL }
+};
+
+static const nbt::Schema mcregionChunkSchema[] = {
+	{ "Level", mcregionLevelSchema },
+	{ NULL, NULL }
+};
+
+static const nbt::Schema anvilSectionSchema[] = {
+	{ "Y", NULL }, { "Blocks", NULL }, { "Add", NULL }, { "Data", NULL },
+	{ "BlockLight", NULL }, { "SkyLight", NULL },
+	{ NULL, NULL }
+};
+
+static const nbt::Schema anvilLevelSchema[] = {
+	{ "Sections", anvilSectionSchema },
+	{ "Biomes", NULL },
+	{ "TileEntities", signSchema },
+	{ NULL, NULL }
+};
+
+static const nbt::Schema anvilChunkSchema[] = {
+	{ "Level", anvilLevelSchema },
+	{ NULL, NULL }
+};
+
+MCMap::MCMap( MCRegionMap *regions, ChunkCache *cache, const nbt::Schema *chunkSchema )
 : lastChunkX(0x7fffffff), lastChunkY(0x7fffffff), lastChunk(NULL)
 , loadedList(NULL)
 , loadedListTail(NULL)
 , nLoadedChunks(0)
 , regions(regions)
+, cache(cache)
+, chunkSchema(chunkSchema)
 {
+	for( unsigned i = 0; i < (1u << LOADED_TABLE_SHIFT); i++ )
+		loadedTable[i].chunk = NULL;
 }
 
 MCMap::~MCMap() {
+	clearAllLoadedChunks();
 }
 
 bool MCMap::getBlockID( int x, int y, int z, unsigned short &id ) {
@@ -48,7 +94,8 @@ bool MCMap::getBlockID( int x, int y, int z, unsigned short &id ) {
 		return false;
 
 	if( z >= chunk->minZ && z <= chunk->maxZ ) {
-		id = chunk->id[(toLinearCoordInChunk(x,y) << chunk->zHtShift) + z - chunk->minZ];
+		unsigned zo = (unsigned)(z - chunk->minZ);
+		id = (unsigned short)chunk->sections[zo>>4]->getState( ((zo&15)<<8) | toSectionCoordInChunk(x,y) );
 	} else {
 		id = 0;
 	}
@@ -97,19 +144,39 @@ unsigned char *MCMap::getBlockData( int x, int y ) {
 bool MCMap::getColumn( int x, int y, MCMap::Column &col ) {
 	Chunk *chunk = getChunk( x, y );
 	if( chunk ) {
-		int pos = toLinearCoordInChunk(x,y) << chunk->zHtShift;
-		col.id = chunk->id + pos;
-		pos >>= 1;
-		col.blockLight = chunk->blockLight + pos;
-		col.skyLight = chunk->skyLight + pos;
-		col.data = chunk->data + pos;
+		col.sections = chunk->sections;
+		col.xy = toSectionCoordInChunk(x,y);
 		col.minZ = chunk->minZ;
 		col.maxZ = chunk->maxZ;
+		col.bottomZ = chunk->bottomZ[col.xy];
+		col.topZ = chunk->topZ[col.xy];
 		return true;
 	}
 	return false;
 }
 
+void MCMap::Column::copyBlocks( int z0, int z1, unsigned short *ids, unsigned char *data, unsigned char *light ) const {
+	int z = z0;
+	for( ; z <= z1 && z < minZ; z++, ids++, data++, light++ ) {
+		*ids = (unsigned short)(z < 0 ? 7 : 0);
+		*data = 0;
+		*light = 0;
+	}
+	for( ; z <= z1 && z <= maxZ; z++, ids++, data++, light++ ) {
+		const ChunkSection *section = getSection( z );
+		unsigned i = getIndex( z );
+		unsigned state = section->getState( i );
+		*ids = (unsigned short)state;
+		*data = (unsigned char)(state >> 16);
+		*light = (unsigned char)(section->getBlockLight( i ) | (section->getSkyLight( i ) << 4));
+	}
+	for( ; z <= z1; z++, ids++, data++, light++ ) {
+		*ids = 0;
+		*data = 0;
+		*light = 0xf0;
+	}
+}
+
 void MCMap::getSignsInArea( int minx, int maxx, int miny, int maxy, MCMap::SignList &signs ) {
 	int maxChunkX = shift_right( maxx, 4 );
 	int maxChunkY = shift_right( maxy, 4 );
@@ -120,28 +187,20 @@ void MCMap::getSignsInArea( int minx, int maxx, int miny, int maxy, MCMap::SignL
 			if( !chunk )
 				continue;
 
-			nbt::Compound *level = (*chunk->nbt)[L"Level"].data.comp;
-			nbt::List *entList = (*level)[L"TileEntities"].data.list;
-			for( nbt::List::const_iterator it = entList->begin(); it != entList->end(); ++it ) {
-				nbt::Compound *te = it->comp;
-				if( *(*te)[L"id"].data.str == L"Sign" ) {
+			for( unsigned i = 0; i < chunk->nSigns; i++ ) {
+				const ChunkCache::Sign &src = chunk->signs[i];
+				if( src.x >= minx && src.x <= maxx && src.y >= miny && src.y <= maxy ) {
 					SignDesc sign;
-					sign.x = (*te)[L"z"].data.i;
-					sign.y = (*te)[L"x"].data.i;
-					if( sign.x >= minx && sign.x <= maxx && sign.y >= miny && sign.y <= maxy ) {
-						sign.z = (*te)[L"y"].data.i;
-						Column col;
-						getColumn( sign.x, sign.y, col );
-						unsigned id = col.getId( sign.z );
-						unsigned data = col.getData( sign.z );
-						sign.onWall = id == 68;
-						sign.orientation = data;
-						sign.text[0] = (*te)[L"Text1"].data.str->c_str();
-						sign.text[1] = (*te)[L"Text2"].data.str->c_str();
-						sign.text[2] = (*te)[L"Text3"].data.str->c_str();
-						sign.text[3] = (*te)[L"Text4"].data.str->c_str();
-						signs.push_back( sign );
+					sign.x = src.x;
+					sign.y = src.y;
+					sign.z = src.z;
+					sign.onWall = src.onWall;
+					sign.orientation = src.orientation;
+					for( unsigned j = 0; j < 4; j++ ) {
+						sign.text[j] = src.text[j];
+						sign.textLen[j] = src.textLen[j];
 					}
+					signs.push_back( sign );
 				}
 			}
 		}
@@ -153,77 +212,239 @@ void MCMap::clearAllLoadedChunks() {
 		unloadOneChunk();
 }
 
+MCMap::LoadedChunk *MCMap::findLoaded( const Coords2D &coords ) {
+	for( unsigned i = hashChunkCoords( coords ); loadedTable[i].chunk; i = nextLoadedSlot( i ) ) {
+		if( loadedTable[i].coords.x == coords.x && loadedTable[i].coords.y == coords.y )
+			return &loadedTable[i];
+	}
+	return NULL;
+}
+
 MCMap::Chunk *MCMap::getChunk_impl( Coords2D &coords ) {
-	ChunkMap::iterator it = loadedChunks.find( coords );
 	lastChunkX = coords.x;
 	lastChunkY = coords.y;
 
-	if( it != loadedChunks.end() ) {
-		// Move the chunk to the front of the loaded list
-		if( it->second.nextLoadedChunk ) {
-			it->second.nextLoadedChunk->toMeLoaded = it->second.toMeLoaded;
-			*it->second.toMeLoaded = it->second.nextLoadedChunk;
+	unsigned i = hashChunkCoords( coords );
+	for( ; loadedTable[i].chunk; i = nextLoadedSlot( i ) ) {
+		LoadedChunk *loaded = &loadedTable[i];
+		if( loaded->coords.x == coords.x && loaded->coords.y == coords.y ) {
+			// Move the chunk to the back of the LRU list
+			if( loaded != loadedListTail ) {
+				unlinkLoaded( loaded );
+				appendLoaded( loaded );
+			}
+			return lastChunk = loaded->chunk;
+		}
+	}
+
+	// Get the chunk from the cache shared with the other workers
+	Chunk *chunk = cache->acquire( coords, this );
+	if( !chunk )
+		return lastChunk = NULL;
+	if( nLoadedChunks >= MAX_LOADED_CHUNKS ) {
+		unloadOneChunk();
+		// Removing an entry can shift others into the free slot
+		for( i = hashChunkCoords( coords ); loadedTable[i].chunk; i = nextLoadedSlot( i ) );
+	}
+
+	LoadedChunk *loaded = &loadedTable[i];
+	loaded->coords = coords;
+	loaded->chunk = chunk;
+	appendLoaded( loaded );
+	nLoadedChunks++;
+
+	return lastChunk = chunk;
+}
+
+bool MCMap::decodeChunk( Chunk &chunk ) {
+	nbt::Document *doc = regions->readChunk( chunk.coords.x, chunk.coords.y, chunkSchema );
+	if( !doc )
+		return false;
+
+	// Everything the renderer needs is copied out, so the NBT can go
+	const nbt::Value *level = doc->getRoot()->get( nbt::ATOM_Level, nbt::TAG_Compound );
+	bool loaded = level && loadChunk( chunk, level );
+	if( loaded ) {
+		findColumnBounds( chunk );
+		extractSigns( chunk, level );
+	}
+	delete doc;
+	return loaded;
+}
 
-			loadedListTail->nextLoadedChunk = &it->second;
-			it->second.toMeLoaded = &loadedListTail->nextLoadedChunk;
+void MCMap::extractSigns( Chunk &chunk, const nbt::Value *level ) {
+	const nbt::Value *entList = level->get( nbt::ATOM_TileEntities, nbt::TAG_List );
+	if( !entList || entList->getListType() != nbt::TAG_Compound )
+		return;
+
+	// Size everything up first so that it fits in one allocation
+	std::vector< const nbt::Value* > signEnts;
+	size_t textBytes = 0;
+	for( unsigned i = 0; i < entList->size(); i++ ) {
+		const nbt::Value *te = entList->at( i );
+		const nbt::Value *id = te->get( nbt::ATOM_id, nbt::TAG_String );
+		if( !id || !(id->equals( "Sign" ) || id->equals( "minecraft:sign" )) )
+			continue;
+		const nbt::Value *tx = te->get( nbt::ATOM_x, nbt::TAG_Int );
+		const nbt::Value *ty = te->get( nbt::ATOM_y, nbt::TAG_Int );
+		const nbt::Value *tz = te->get( nbt::ATOM_z, nbt::TAG_Int );
+		if( !tx || !ty || !tz )
+			continue;
+		// Signs are in world coords, and must be within the chunk
+		if( shift_right( tz->i, 4 ) != chunk.coords.y || shift_right( tx->i, 4 ) != chunk.coords.x )
+			continue;
+		signEnts.push_back( te );
+		for( unsigned j = 0; j < 4; j++ ) {
+			const nbt::Value *text = te->get( (nbt::Atom)(nbt::ATOM_Text1 + j), nbt::TAG_String );
+			if( text )
+				textBytes += std::min( text->size(), 0xffffu );
 		}
-	} else {
-		// Try to load the chunk
-		Chunk chunk;
-		chunk.coords = coords;
-		chunk.nbt = regions->readChunk( coords.x, coords.y );
-		if( !chunk.nbt )
-			return lastChunk = NULL;
-		if( nLoadedChunks >= 200 )
-			unloadOneChunk();
-		if( !loadChunk( chunk ) )
-			return lastChunk = NULL;
-
-		nLoadedChunks++;
-		loadedChunks[coords] = chunk;
-
-		it = loadedChunks.find( coords );
-		if( loadedListTail ) {
-			loadedListTail->nextLoadedChunk = &it->second;
-			it->second.toMeLoaded = &loadedListTail->nextLoadedChunk;
-		} else {
-			loadedList = &it->second;
-			it->second.toMeLoaded = &loadedList;
+	}
+	if( signEnts.empty() )
+		return;
+
+	size_t bytes = signEnts.size() * sizeof(ChunkCache::Sign) + textBytes;
+	chunk.signs = (ChunkCache::Sign*)malloc( bytes );
+	if( !chunk.signs )
+		return;
+	chunk.nSigns = (unsigned)signEnts.size();
+	chunk.signBytes = (unsigned)bytes;
+
+	char *textOut = (char*)(chunk.signs + chunk.nSigns);
+	for( unsigned i = 0; i < chunk.nSigns; i++ ) {
+		const nbt::Value *te = signEnts[i];
+		ChunkCache::Sign &sign = chunk.signs[i];
+		sign.x = te->get( nbt::ATOM_z, nbt::TAG_Int )->i;
+		sign.y = te->get( nbt::ATOM_x, nbt::TAG_Int )->i;
+		sign.z = te->get( nbt::ATOM_y, nbt::TAG_Int )->i;
+
+		unsigned id = 0, data = 0;
+		if( sign.z >= chunk.minZ && sign.z <= chunk.maxZ ) {
+			unsigned zo = (unsigned)(sign.z - chunk.minZ);
+			unsigned state = chunk.sections[zo>>4]->getState( ((zo&15)<<8) | toSectionCoordInChunk( sign.x, sign.y ) );
+			id = state & 0xffffu;
+			data = state >> 16;
+		}
+		sign.onWall = id == 68;
+		sign.orientation = (unsigned char)data;
+
+		for( unsigned j = 0; j < 4; j++ ) {
+			const nbt::Value *text = te->get( (nbt::Atom)(nbt::ATOM_Text1 + j), nbt::TAG_String );
+			unsigned len = text ? std::min( text->size(), 0xffffu ) : 0;
+			memcpy( textOut, text ? text->str : "", len );
+			sign.text[j] = textOut;
+			sign.textLen[j] = (unsigned short)len;
+			textOut += len;
 		}
 	}
+}
 
-	lastChunk = loadedListTail = &it->second;
-	loadedListTail->nextLoadedChunk = NULL;
-
-	return loadedListTail;
+void MCMap::findColumnBounds( Chunk &chunk ) {
+	// Find the range of sections which have anything in them first
+	int firstSection = 0, lastSection = (int)chunk.nSections - 1;
+	while( firstSection <= lastSection && chunk.sections[firstSection]->isAir() )
+		firstSection++;
+	while( lastSection >= firstSection && chunk.sections[lastSection]->isAir() )
+		lastSection--;
+
+	for( unsigned xy = 0; xy < 16*16; xy++ ) {
+		int bottom = chunk.maxZ + 1, top = chunk.minZ - 1;
+		for( int zs = firstSection; zs <= lastSection && bottom > chunk.maxZ; zs++ ) {
+			const ChunkSection *section = chunk.sections[zs];
+			if( section->isAir() )
+				continue;
+			for( unsigned zo = 0; zo < 16; zo++ ) {
+				if( section->getState( (zo<<8) | xy ) & 0xffffu ) {
+					bottom = chunk.minZ + (zs<<4) + (int)zo;
+					break;
+				}
+			}
+		}
+		for( int zs = lastSection; zs >= firstSection && top < chunk.minZ; zs-- ) {
+			const ChunkSection *section = chunk.sections[zs];
+			if( section->isAir() )
+				continue;
+			for( int zo = 15; zo >= 0; zo-- ) {
+				if( section->getState( ((unsigned)zo<<8) | xy ) & 0xffffu ) {
+					top = chunk.minZ + (zs<<4) + zo;
+					break;
+				}
+			}
+		}
+		chunk.bottomZ[xy] = (short)bottom;
+		chunk.topZ[xy] = (short)top;
+	}
 }
 
 void MCMap::unloadOneChunk() {
 	assert( loadedList );
-	
-	Coords2D coords = loadedList->coords;
 
-	delete loadedList->nbt;
-	loadedList->nbt = NULL;
+	Chunk *chunk = loadedList->chunk;
+	if( chunk == lastChunk ) {
+		lastChunkX = 0x7fffffff;
+		lastChunkY = 0x7fffffff;
+		lastChunk = NULL;
+	}
+	removeLoaded( loadedList );
+	nLoadedChunks--;
 
-	unloadChunk( *loadedList );
+	cache->release( chunk );
+}
 
-	if( loadedList->nextLoadedChunk ) {
-		loadedList->nextLoadedChunk->toMeLoaded = loadedList->toMeLoaded;
+void MCMap::appendLoaded( LoadedChunk *loaded ) {
+	loaded->nextLoaded = NULL;
+	loaded->prevLoaded = loadedListTail;
+	if( loadedListTail ) {
+		loadedListTail->nextLoaded = loaded;
 	} else {
-		lastChunkX = 0x7fffffff;
-		lastChunkY = 0x7fffffff;
-		lastChunk = loadedListTail = NULL;
+		loadedList = loaded;
 	}
-	*loadedList->toMeLoaded = loadedList->nextLoadedChunk;
+	loadedListTail = loaded;
+}
 
-	nLoadedChunks--;
+void MCMap::unlinkLoaded( LoadedChunk *loaded ) {
+	if( loaded->prevLoaded ) {
+		loaded->prevLoaded->nextLoaded = loaded->nextLoaded;
+	} else {
+		loadedList = loaded->nextLoaded;
+	}
+	if( loaded->nextLoaded ) {
+		loaded->nextLoaded->prevLoaded = loaded->prevLoaded;
+	} else {
+		loadedListTail = loaded->prevLoaded;
+	}
+}
 
-	loadedChunks.erase( loadedChunks.find( coords ) );
+void MCMap::removeLoaded( LoadedChunk *loaded ) {
+	unlinkLoaded( loaded );
+
+	// Shift the following entries back so that no probe sequence is broken
+	unsigned hole = (unsigned)(loaded - loadedTable);
+	for( unsigned i = nextLoadedSlot( hole ); loadedTable[i].chunk; i = nextLoadedSlot( i ) ) {
+		unsigned home = hashChunkCoords( loadedTable[i].coords );
+		bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+		if( stays )
+			continue;
+
+		LoadedChunk *from = &loadedTable[i], *to = &loadedTable[hole];
+		*to = *from;
+		if( to->prevLoaded ) {
+			to->prevLoaded->nextLoaded = to;
+		} else {
+			loadedList = to;
+		}
+		if( to->nextLoaded ) {
+			to->nextLoaded->prevLoaded = to;
+		} else {
+			loadedListTail = to;
+		}
+		hole = i;
+	}
+	loadedTable[hole].chunk = NULL;
 }
 
-MCMap_MCRegion::MCMap_MCRegion( MCRegionMap *regions )
-: MCMap( regions )
+MCMap_MCRegion::MCMap_MCRegion( MCRegionMap *regions, ChunkCache *cache )
+: MCMap( regions, cache, mcregionChunkSchema )
 {
 }
 
@@ -235,35 +456,48 @@ void MCMap_MCRegion::getExtentsWithin( int&, int&, int&, int&, int &minz, int &m
 	maxz = 127;
 }
 
-bool MCMap_MCRegion::loadChunk( MCMap::Chunk &chunk ) {
-	nbt::Compound *level = (*chunk.nbt)[L"Level"].data.comp;
-	chunk.blockLight = (unsigned char*)(*level)[L"BlockLight"].data.bytes;
-	chunk.skyLight = (unsigned char*)(*level)[L"SkyLight"].data.bytes;
-	chunk.data = (unsigned char*)(*level)[L"Data"].data.bytes;
+bool MCMap_MCRegion::loadChunk( MCMap::Chunk &chunk, const nbt::Value *level ) {
+	const unsigned char *idsrc = getByteArray( level, nbt::ATOM_Blocks, 16*16*128 );
+	const unsigned char *blockLight = getByteArray( level, nbt::ATOM_BlockLight, 16*16*128/2 );
+	const unsigned char *skyLight = getByteArray( level, nbt::ATOM_SkyLight, 16*16*128/2 );
+	const unsigned char *data = getByteArray( level, nbt::ATOM_Data, 16*16*128/2 );
+	if( !idsrc || !blockLight || !skyLight || !data )
+		return false;
 
 	chunk.minZ = 0;
 	chunk.maxZ = 127;
-	chunk.zHtShift = 7;
 	chunk.biomes = NULL;
-
-	const unsigned char *idsrc = (unsigned char*)(*level)[L"Blocks"].data.bytes;
-	chunk.id = new unsigned short[16*16*128];
-	for( unsigned i = 0; i < 16*16*128; i++ )
-		chunk.id[i] = idsrc[i];
+	chunk.nSections = 8;
+	chunk.sections = new ChunkSection*[chunk.nSections];
+
+	// Reorder each slice of the x-major columns into a section
+	uint32_t states[ChunkSection::BLOCKS];
+	unsigned char sectionBlockLight[ChunkSection::BLOCKS/2];
+	unsigned char sectionSkyLight[ChunkSection::BLOCKS/2];
+	for( unsigned zs = 0; zs < chunk.nSections; zs++ ) {
+		memset( sectionBlockLight, 0, sizeof(sectionBlockLight) );
+		memset( sectionSkyLight, 0, sizeof(sectionSkyLight) );
+		for( unsigned xy = 0; xy < 16*16; xy++ ) {
+			unsigned srcBase = (((xy&15)<<4) | (xy>>4)) << 7;
+			for( unsigned zo = 0; zo < 16; zo++ ) {
+				unsigned srcIdx = srcBase + (zs<<4) + zo;
+				unsigned destIdx = (zo<<8) | xy;
+				unsigned src4Shift = (srcIdx&1u)<<2;
+				unsigned dest4Shift = (destIdx&1u)<<2;
+				states[destIdx] = idsrc[srcIdx] | (((data[srcIdx>>1] >> src4Shift) & 0xfu) << 16);
+				sectionBlockLight[destIdx>>1] |= ((blockLight[srcIdx>>1] >> src4Shift) & 0xfu) << dest4Shift;
+				sectionSkyLight[destIdx>>1] |= ((skyLight[srcIdx>>1] >> src4Shift) & 0xfu) << dest4Shift;
+			}
+		}
+		ChunkSection *section = ChunkSection::build( states, sectionBlockLight, sectionSkyLight, sectionScratch );
+		chunk.sections[zs] = section ? section : ChunkSection::getEmpty();
+	}
 
 	return true;
 }
 
-void MCMap_MCRegion::unloadChunk( Chunk &chunk ) {
-	delete[] chunk.id;
-	chunk.id = NULL;
-	chunk.blockLight = NULL;
-	chunk.skyLight = NULL;
-	chunk.data = NULL;
-}
-
-MCMap_Anvil::MCMap_Anvil( MCRegionMap *regions )
-: MCMap( regions )
+MCMap_Anvil::MCMap_Anvil( MCRegionMap *regions, ChunkCache *cache )
+: MCMap( regions, cache, anvilChunkSchema )
 {
 }
 
@@ -279,16 +513,26 @@ void MCMap_Anvil::getExtentsWithin( int &minx, int &maxx, int &miny, int &maxy,
 	int cminz = INT_MAX, cmaxz = INT_MIN;
 	for( int cx = minChunkX; cx <= maxChunkX; cx++ ) {
 		for( int cy = minChunkY; cy <= maxChunkY; cy++ ) {
+			// Chunks which are already loaded are used as they are;
+			// the rest only have their section heights read
 			Coords2D coords = { cy, cx };
-			Chunk *chunk = getChunk_impl( coords );
-			if( chunk ) {
-				cminx = std::min( cminx, cx << 4 );
-				cmaxx = std::max( cmaxx, (cx << 4) + 15 );
-				cminy = std::min( cminy, cy << 4 );
-				cmaxy = std::max( cmaxx, (cy << 4) + 15 );
-				cminz = std::min( cminz, chunk->minZ );
-				cmaxz = std::max( cmaxz, chunk->maxZ );
+			LoadedChunk *loaded = findLoaded( coords );
+			int chunkMinZ, chunkMaxZ;
+			if( loaded ) {
+				chunkMinZ = loaded->chunk->minZ;
+				chunkMaxZ = loaded->chunk->maxZ;
+			} else if( regions->getChunkSectionRange( cy, cx, chunkMinZ, chunkMaxZ ) ) {
+				chunkMinZ <<= 4;
+				chunkMaxZ = (chunkMaxZ << 4) + 15;
+			} else {
+				continue;
 			}
+			cminx = std::min( cminx, cx << 4 );
+			cmaxx = std::max( cmaxx, (cx << 4) + 15 );
+			cminy = std::min( cminy, cy << 4 );
+			cmaxy = std::max( cmaxy, (cy << 4) + 15 );
+			cminz = std::min( cminz, chunkMinZ );
+			cmaxz = std::max( cmaxz, chunkMaxZ );
 		}
 	}
 	
@@ -300,14 +544,18 @@ void MCMap_Anvil::getExtentsWithin( int &minx, int &maxx, int &miny, int &maxy,
 	maxz = std::min( maxz, cmaxz );
 }
 
-bool MCMap_Anvil::loadChunk( MCMap::Chunk &chunk ) {
-	nbt::Compound *level = (*chunk.nbt)[L"Level"].data.comp;
-	nbt::List *sections = (*level)[L"Sections"].data.list;
+bool MCMap_Anvil::loadChunk( MCMap::Chunk &chunk, const nbt::Value *level ) {
+	const nbt::Value *sections = level->get( nbt::ATOM_Sections, nbt::TAG_List );
+	if( !sections || sections->getListType() != nbt::TAG_Compound )
+		return false;
 
 	chunk.minZ = INT_MAX;
 	chunk.maxZ = INT_MIN;
-	for( nbt::List::const_iterator it = sections->begin(); it != sections->end(); ++it ) {
-		int zbase = (*it->comp)[L"Y"].data.b << 4;
+	for( unsigned i = 0; i < sections->size(); i++ ) {
+		const nbt::Value *y = sections->at( i )->get( nbt::ATOM_Y, nbt::TAG_Byte );
+		if( !y )
+			continue;
+		int zbase = y->b << 4;
 		if( zbase < chunk.minZ )
 			chunk.minZ = zbase;
 		if( zbase + 15 > chunk.maxZ )
@@ -317,61 +565,35 @@ bool MCMap_Anvil::loadChunk( MCMap::Chunk &chunk ) {
 	if( chunk.minZ == INT_MAX )
 		return false;
 
-	unsigned zHeight = chunk.maxZ - chunk.minZ + 1;
-	unsigned zSections = zHeight>>4;
-	chunk.zHtShift = 4;
-	while( zHeight > (1u << chunk.zHtShift) )
-		chunk.zHtShift++;
-
-	unsigned blocks = (16*16) << chunk.zHtShift;
-	chunk.id = new unsigned short[blocks];
-	chunk.blockLight = new unsigned char[blocks>>1];
-	chunk.skyLight = new unsigned char[blocks>>1];
-	chunk.data = new unsigned char[blocks>>1];
-	memset( chunk.id, 0, blocks<<1 );
-	memset( chunk.blockLight, 0, blocks>>1 );
-	memset( chunk.skyLight, 0, blocks>>1 );
-	memset( chunk.data, 0, blocks>>1 );
-	bool *zSectionFilled = new bool[zSections];
-	for( unsigned i = 0; i < zSections; i++ )
-		zSectionFilled[i] = false;
-
-	for( nbt::List::const_iterator it = sections->begin(); it != sections->end(); ++it ) {
-		nbt::Compound *section = it->comp;
-		int zbase = (*section)[L"Y"].data.b;
-		zbase = (zbase << 4) - chunk.minZ;
-		zSectionFilled[zbase>>4] = true;
-
-		unsigned char *idSrc = (unsigned char*)(*section)[L"Blocks"].data.bytes;
-		unsigned char *blockLightSrc = (unsigned char*)(*section)[L"BlockLight"].data.bytes;
-		unsigned char *skyLightSrc = (unsigned char*)(*section)[L"SkyLight"].data.bytes;
-		unsigned char *dataSrc = (unsigned char*)(*section)[L"Data"].data.bytes;
-		unsigned char *addSrc = NULL;
-		if( section->find( L"Add" ) != section->end() )
-			addSrc = (unsigned char*)(*section)[L"Add"].data.bytes;
-
-		for( int zo = 0; zo < 16; zo++ ) {
-			for( int yo = 0; yo < 16; yo++ ) {
-				for( int xo = 0; xo < 16; xo++ ) {
-					unsigned destIdx = (((xo<<4)+yo) << chunk.zHtShift) + zbase + zo;
-					unsigned srcIdx = (zo<<8)+(yo<<4)+xo;
-					unsigned src4Shift = ((srcIdx&1u)<<2);
-					unsigned dest4Shift = ((destIdx&1u)<<2);
-
-					chunk.id[destIdx] = idSrc[srcIdx];
-					if( addSrc )
-						chunk.id[destIdx] += (unsigned short)((addSrc[srcIdx>>1] >> src4Shift) & 0xfu) << 8;
-
-					chunk.blockLight[destIdx>>1] |= ((blockLightSrc[srcIdx>>1] >> src4Shift) & 0xfu) << dest4Shift;
-					chunk.skyLight[destIdx>>1] |= ((skyLightSrc[srcIdx>>1] >> src4Shift) & 0xfu) << dest4Shift;
-					chunk.data[destIdx>>1] |= ((dataSrc[srcIdx>>1] >> src4Shift) & 0xfu) << dest4Shift;
-				}
-			}
+	chunk.nSections = (unsigned)(chunk.maxZ - chunk.minZ + 1) >> 4;
+	chunk.sections = new ChunkSection*[chunk.nSections];
+	for( unsigned i = 0; i < chunk.nSections; i++ )
+		chunk.sections[i] = ChunkSection::getEmpty();
+
+	// Sections missing from the chunk are left empty, in full sun
+	uint32_t states[ChunkSection::BLOCKS];
+	for( unsigned i = 0; i < sections->size(); i++ ) {
+		const nbt::Value *section = sections->at( i );
+		const nbt::Value *y = section->get( nbt::ATOM_Y, nbt::TAG_Byte );
+		const unsigned char *idSrc = getByteArray( section, nbt::ATOM_Blocks, 4096 );
+		const unsigned char *blockLightSrc = getByteArray( section, nbt::ATOM_BlockLight, 2048 );
+		const unsigned char *skyLightSrc = getByteArray( section, nbt::ATOM_SkyLight, 2048 );
+		const unsigned char *dataSrc = getByteArray( section, nbt::ATOM_Data, 2048 );
+		const unsigned char *addSrc = getByteArray( section, nbt::ATOM_Add, 2048 );
+		if( !y || !idSrc || !blockLightSrc || !skyLightSrc || !dataSrc )
+			continue;
+
+		ChunkSection::decodeStates( idSrc, addSrc, dataSrc, states );
+		ChunkSection *built = ChunkSection::build( states, blockLightSrc, skyLightSrc, sectionScratch );
+		if( built ) {
+			ChunkSection *&dest = chunk.sections[((y->b << 4) - chunk.minZ) >> 4];
+			ChunkSection::destroy( dest );
+			dest = built;
 		}
 	}
 
-	if( level->find( L"Biomes" ) != level->end() ) {
-		unsigned char *biomeIds = (unsigned char*)(*level)[L"Biomes"].data.bytes;
+	const unsigned char *biomeIds = getByteArray( level, nbt::ATOM_Biomes, 256 );
+	if( biomeIds ) {
 		chunk.biomes = new unsigned short[16*16];
 		const static unsigned short biomeIdToCoords[] = {
 			0xBF7Fu, // Ocean
@@ -409,36 +631,5 @@ bool MCMap_Anvil::loadChunk( MCMap::Chunk &chunk ) {
 		chunk.biomes = NULL;
 	}
 
-	for( unsigned zs = 0; zs < zSections; zs++ ) {
-		if( !zSectionFilled[zs] ) {
-			unsigned zbase = zs << 4;
-			for( unsigned x = 0; x < 16; x++ ) {
-				for( unsigned y = 0; y < 16; y++ ) {
-					unsigned xyc = toLinearCoordInChunk(x,y) << chunk.zHtShift;
-					for( unsigned zo = 0; zo < 16; zo+=2 ) {
-						// TODO: Copy the top block's luminance
-						// for now, full sun in skipped blocks
-						chunk.skyLight[(xyc+zbase+zo)>>1] = 0xffu;
-					}
-				}
-			}
-		}
-	}
-
-	delete[] zSectionFilled;
-
 	return true;
 }
-
-void MCMap_Anvil::unloadChunk( Chunk &chunk ) {
-	delete[] chunk.id;
-	chunk.id = NULL;
-	delete[] chunk.blockLight;
-	chunk.blockLight = NULL;
-	delete[] chunk.skyLight;
-	chunk.skyLight = NULL;
-	delete[] chunk.data;
-	chunk.data = NULL;
-	delete[] chunk.biomes;
-	chunk.biomes = NULL;
-}
@@ -24,35 +24,46 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #ifndef MCMAP_H
 #define MCMAP_H
 
-#include <map>
+#include <list>
 #include <string>
+#include <vector>
 
-#include "nbt.h"
+#include "chunkcache.h"
+#include "nbtdoc.h"
 #include "jmath.h"
 #include "mcregionmap.h"
 #include "platform.h"
 
 class MCMap {
+	friend class ChunkCache;
+
 public:
-	explicit MCMap( MCRegionMap *regions );
-	~MCMap();
+	MCMap( MCRegionMap *regions, ChunkCache *cache, const nbt::Schema *chunkSchema );
+	virtual ~MCMap();
 
+	// A view of one column of blocks in a chunk's sections
 	struct Column {
-		inline unsigned getId( int z ) const { return z < minZ ? (z < 0 ? 7 : 0) : z > maxZ ? 0 : id[z-minZ]; }
-		static inline unsigned get4bitsAt( unsigned char *dat, unsigned zo )
-			{ return (unsigned)((dat[zo>>1] >> ((zo&1)<<2)) & 0xf); }
-		inline unsigned get4BitsAtSafe( unsigned char *dat, int z, unsigned high ) const
-			{ return z < minZ ? 0 : z > maxZ ? high : get4bitsAt(dat, z-minZ); }
-		inline unsigned getBlockLight( int z ) const { return get4BitsAtSafe( blockLight, z, 0 ); }
-		inline unsigned getSkyLight( int z ) const { return get4BitsAtSafe( skyLight, z, 0xf ); }
-		inline unsigned getData( int z ) const { return get4BitsAtSafe( data, z, 0 ); }
+		inline unsigned getId( int z ) const { return z < minZ ? (z < 0 ? 7 : 0) : z > maxZ ? 0 : getState( z ) & 0xffffu; }
+		inline unsigned getData( int z ) const { return z < minZ || z > maxZ ? 0 : getState( z ) >> 16; }
+		inline unsigned getBlockLight( int z ) const
+			{ return z < minZ || z > maxZ ? 0 : getSection( z )->getBlockLight( getIndex( z ) ); }
+		inline unsigned getSkyLight( int z ) const
+			{ return z < minZ ? 0 : z > maxZ ? 0xf : getSection( z )->getSkyLight( getIndex( z ) ); }
 		inline unsigned getHeight() const { return maxZ-minZ+1; }
 
-		unsigned short *id;
-		unsigned char *blockLight;
-		unsigned char *skyLight;
-		unsigned char *data;
+		// Copies the blocks from z0 to z1; light is packed as block | sky << 4
+		void copyBlocks( int z0, int z1, unsigned short *ids, unsigned char *data, unsigned char *light ) const;
+
+		const ChunkSection *const *sections;
+		unsigned xy;
 		int minZ, maxZ;
+		// Everything from minZ to maxZ outside of these is air
+		int bottomZ, topZ;
+
+	private:
+		inline const ChunkSection *getSection( int z ) const { return sections[(unsigned)(z-minZ)>>4]; }
+		inline unsigned getIndex( int z ) const { return (((unsigned)z&15)<<8) | xy; }
+		inline unsigned getState( int z ) const { return getSection( z )->getState( getIndex( z ) ); }
 	};
 
 	bool getBlockID( int x, int y, int z, unsigned short &id );
@@ -71,7 +82,9 @@ public:
 		int x, y, z;
 		bool onWall;
 		unsigned orientation;
-		const wchar_t *text[4];
+		// UTF-8, not null-terminated
+		const char *text[4];
+		unsigned textLen[4];
 	};
 	typedef std::list<SignDesc> SignList;
 	void getSignsInArea( int minx, int maxx, int miny, int maxy, SignList &signs );
@@ -81,23 +94,23 @@ public:
 protected:
 	void exploreDirectories();
 
-	struct Chunk {
-		nbt::Compound *nbt;
-		unsigned short *id;
-		unsigned char *blockLight;
-		unsigned char *skyLight;
-		unsigned char *data;
-		unsigned short *biomes;
-		Chunk *nextLoadedChunk;
-		Chunk **toMeLoaded;
+	typedef ChunkCache::Chunk Chunk;
+
+	// A chunk this map holds a reference to
+	// These live in an open-addressing table, threaded with an LRU list
+	struct LoadedChunk {
 		Coords2D coords;
-		int minZ, maxZ;
-		unsigned zHtShift;
+		Chunk *chunk; // NULL if the slot is empty
+		LoadedChunk *prevLoaded, *nextLoaded;
 	};
 
 	static inline unsigned toLinearCoordInChunk( int x, int y ) {
 		return (((unsigned)y&15)<<4) | ((unsigned)x&15);
 	}
+	// The column's index within a ChunkSection
+	static inline unsigned toSectionCoordInChunk( int x, int y ) {
+		return (((unsigned)x&15)<<4) | ((unsigned)y&15);
+	}
 
 	inline Chunk *getChunk( int x, int y ) {
 		Coords2D coords;
@@ -108,46 +121,66 @@ protected:
 		return getChunk_impl( coords );
 	}
 	Chunk *getChunk_impl( Coords2D &coords );
-	virtual bool loadChunk( Chunk &chunk ) = 0;
-	virtual void unloadChunk( Chunk &chunk ) = 0;
+	enum {
+		MAX_LOADED_CHUNKS = 200,
+		LOADED_TABLE_SHIFT = 9 // The table is kept at most 40% full
+	};
+	static inline unsigned hashChunkCoords( const Coords2D &c ) {
+		return (((unsigned)c.x * 0x9e3779b1u) ^ ((unsigned)c.y * 0x85ebca6bu)) >> (32 - LOADED_TABLE_SHIFT);
+	}
+	static inline unsigned nextLoadedSlot( unsigned i ) {
+		return (i + 1) & ((1u << LOADED_TABLE_SHIFT) - 1);
+	}
+	LoadedChunk *findLoaded( const Coords2D &coords );
+	// Reads and decodes a chunk for the cache
+	bool decodeChunk( Chunk &chunk );
+	static void findColumnBounds( Chunk &chunk );
+	static void extractSigns( Chunk &chunk, const nbt::Value *level );
+	virtual bool loadChunk( Chunk &chunk, const nbt::Value *level ) = 0;
 
 	int lastChunkX, lastChunkY;
 	Chunk *lastChunk;
 
-	typedef std::map< Coords2D, Chunk > ChunkMap;
-	ChunkMap loadedChunks;
 	std::string root;
 
 	void unloadOneChunk();
-	Chunk *loadedList;
-	Chunk *loadedListTail;
+	void appendLoaded( LoadedChunk *loaded );
+	void unlinkLoaded( LoadedChunk *loaded );
+	void removeLoaded( LoadedChunk *loaded );
+	LoadedChunk loadedTable[1 << LOADED_TABLE_SHIFT];
+	// Least recently used first
+	LoadedChunk *loadedList;
+	LoadedChunk *loadedListTail;
 	unsigned nLoadedChunks;
 
 	MCRegionMap *regions;
+	ChunkCache *cache;
+	// The parts of the chunk NBT which loadChunk and extractSigns read
+	const nbt::Schema *chunkSchema;
+	// Each map decodes on one thread at a time
+	ChunkSection::BuildScratch sectionScratch;
 };
 
 class MCMap_MCRegion : public MCMap {
 public:
-	explicit MCMap_MCRegion( MCRegionMap *regions );
+	MCMap_MCRegion( MCRegionMap *regions, ChunkCache *cache );
 	~MCMap_MCRegion();
 
 	virtual void getExtentsWithin( int &minx, int &maxx, int &miny, int &maxy, int &minz, int &maxz );
 
 protected:
-	virtual bool loadChunk( Chunk &chunk );
-	virtual void unloadChunk( Chunk &chunk );
+	virtual bool loadChunk( Chunk &chunk, const nbt::Value *level );
 };
 
 class MCMap_Anvil : public MCMap {
 public:
-	explicit MCMap_Anvil( MCRegionMap *regions );
+	MCMap_Anvil( MCRegionMap *regions, ChunkCache *cache );
 	~MCMap_Anvil();
 
 	virtual void getExtentsWithin( int &minx, int &maxx, int &miny, int &maxy, int &minz, int &maxz );
 
 protected:
-	virtual bool loadChunk( Chunk &chunk );
-	virtual void unloadChunk( Chunk &chunk );
+	virtual bool loadChunk( Chunk &chunk, const nbt::Value *level );
 };
 
 #endif
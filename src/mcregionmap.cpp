@@ -22,12 +22,15 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 
+#include <algorithm>
+
 #include "findfile.h"
 #include "mcregionmap.h"
 #include "mcbiome.h"
 #include "worldqtree.h"
 #include "platform.h"
 #include "endian.h"
+#include "decompress.h"
 
 #define MCREGIONMAP_META "MCRegionMap"
 
@@ -46,18 +49,39 @@ inline int toRegionCoord( int x ) {
 	return shift_right( x, 5 );
 }
 
+namespace {
+
+// Counts the thread as a reader of the region table while in scope
+class RegionTableReader {
+public:
+	explicit RegionTableReader( SDL_atomic_t *readers ) : readers(readers) { SDL_AtomicIncRef( readers ); }
+	~RegionTableReader() { SDL_AtomicAdd( readers, -1 ); }
+private:
+	SDL_atomic_t *readers;
+};
+
+} // <anonymous>
+
 MCRegionMap::MCRegionMap( const char *rootPath, bool anvil )
 : root(""), anvil(anvil)
 , minRgX(0), maxRgX(0), minRgY(0), maxRgY(0)
+, nRegions(0)
 , watchUpdates(false)
 {
+	memset( &regionBuckets[0], 0, sizeof(regionBuckets) );
+	SDL_AtomicSet( &activeReaders, 0 );
+	rgDescMutex = SDL_CreateMutex();
+
 	changeRoot( rootPath, anvil );
 
-	rgDescMutex = SDL_CreateMutex();
 	changeThread = SDL_CreateThread( updateScanner, "Eihort File Scanner", this );
 }
 
 MCRegionMap::~MCRegionMap() {
+	SDL_mutexP( rgDescMutex );
+	flushRegionSectors();
+	SDL_mutexV( rgDescMutex );
+	deleteRetiredRegions();
 }
 
 void MCRegionMap::changeRoot( const char *newRoot, bool anvil ) {
@@ -66,12 +90,16 @@ void MCRegionMap::changeRoot( const char *newRoot, bool anvil ) {
 	if( root[this->root.length()-1] == '/' || root[this->root.length()-1] == '\\' )
 		this->root = this->root.substr( 0, this->root.length()-1 );
 	
+	SDL_mutexP( rgDescMutex );
 	flushRegionSectors();
 	exploreDirectories();
+	SDL_mutexV( rgDescMutex );
 }
 
 void MCRegionMap::checkForRegionChanges() {
+	SDL_mutexP( rgDescMutex );
 	exploreDirectories();
+	SDL_mutexV( rgDescMutex );
 }
 
 MCRegionMap::ChangeListener::ChangeListener() {
@@ -96,14 +124,159 @@ void MCRegionMap::getWorldBlockExtents( int &minx, int &maxx, int &miny, int &ma
 	maxx = ((maxRgY+1) << rgShift) - 1;
 }
 
-nbt::Compound *MCRegionMap::readChunk( int x, int y ) {
-	unsigned t;
-	if( getChunkInfo( x, y, t ) ) {
-		char regionfn[MAX_PATH];
-		snprintf( regionfn, MAX_PATH, "%s/region/r.%d.%d.%s", root.c_str(), toRegionCoord(x), toRegionCoord(y), getRegionExt() );
-		return nbt::readFromRegionFile( regionfn, ((unsigned)x&31) + (((unsigned)y&31)<<5) );
+nbt::Document *MCRegionMap::readChunk( int x, int y, const nbt::Schema *schema ) {
+	RegionTableReader reader( &activeReaders );
+	Coords2D c = { toRegionCoord(x), toRegionCoord(y) };
+	RegionDesc *rg = findRegion( c );
+	if( !rg )
+		return NULL;
+	RegionHeader *header = acquireHeader( rg );
+	if( !header )
+		return NULL;
+
+	nbt::Document *chunk = readChunkFrom( header, x, y, schema );
+	releaseHeader( header );
+	return chunk;
+}
+
+nbt::Document *MCRegionMap::readChunkFrom( RegionHeader *header, int x, int y, const nbt::Schema *schema ) {
+	nbt::Document *chunk = NULL;
+	uint32_t sector = header->sectors[((unsigned)x&31) + (((unsigned)y&31)<<5)];
+	//return chunkTimes[i] != 0; // Apparently the timestamps are unreliable. This punches holes in the world.
+	size_t offset = (size_t)(sector >> 8) << 12;
+	if( offset != 0 && offset + 5 <= header->map.getSize() ) {
+		const unsigned char *chunkData = header->map.getData() + offset;
+		if( chunkData[4] & COMPRESSION_EXTERNAL ) {
+			// Oversized chunks live in their own c.X.Z.mcc file
+			char chunkfn[MAX_PATH];
+			snprintf( chunkfn, MAX_PATH, "%s/region/c.%d.%d.mcc", root.c_str(), x, y );
+			MappedFile external;
+			if( external.open( chunkfn ) )
+				chunk = nbt::readDocumentFromCompressedData( chunkData[4] & ~COMPRESSION_EXTERNAL, external.getData(), external.getSize(), schema );
+		} else {
+			chunk = nbt::readDocumentFromRegionData( chunkData, header->map.getSize() - offset, schema );
+		}
+	}
+	return chunk;
+}
+
+static const nbt::Schema sectionYSchema[] = {
+	{ "Y", NULL },
+	{ NULL, NULL }
+};
+
+static const nbt::Schema sectionRangeLevelSchema[] = {
+	{ "Sections", sectionYSchema },
+	{ NULL, NULL }
+};
+
+static const nbt::Schema sectionRangeSchema[] = {
+	{ "Level", sectionRangeLevelSchema },
+	{ NULL, NULL }
+};
+
+bool MCRegionMap::getChunkSectionRange( int x, int y, int &minSection, int &maxSection ) {
+	RegionTableReader reader( &activeReaders );
+	Coords2D c = { toRegionCoord(x), toRegionCoord(y) };
+	RegionDesc *rg = findRegion( c );
+	if( !rg )
+		return false;
+	RegionHeader *header = acquireHeader( rg );
+	if( !header )
+		return false;
+
+	SDL_atomic_t *cached = &header->sectionRanges[((unsigned)x&31) + (((unsigned)y&31)<<5)];
+	int range = SDL_AtomicGet( cached );
+	if( !range ) {
+		int minY = INT_MAX, maxY = INT_MIN;
+		nbt::Document *doc = readChunkFrom( header, x, y, sectionRangeSchema );
+		const nbt::Value *level = doc ? doc->getRoot()->get( nbt::ATOM_Level, nbt::TAG_Compound ) : NULL;
+		const nbt::Value *sections = level ? level->get( nbt::ATOM_Sections, nbt::TAG_List ) : NULL;
+		if( sections && sections->getListType() == nbt::TAG_Compound ) {
+			for( unsigned i = 0; i < sections->size(); i++ ) {
+				const nbt::Value *sy = sections->at( i )->get( nbt::ATOM_Y, nbt::TAG_Byte );
+				if( sy ) {
+					minY = std::min( minY, (int)sy->b );
+					maxY = std::max( maxY, (int)sy->b );
+				}
+			}
+		}
+		delete doc;
+
+		// Missing chunks are remembered too, as empty
+		if( minY == INT_MAX ) {
+			range = SECTION_RANGE_EMPTY;
+		} else {
+			range = SECTION_RANGE_KNOWN | ((minY & 0xff) << 8) | (maxY & 0xff);
+		}
+		SDL_AtomicSet( cached, range );
+	}
+	releaseHeader( header );
+
+	if( range & SECTION_RANGE_EMPTY )
+		return false;
+	minSection = (signed char)((range >> 8) & 0xff);
+	maxSection = (signed char)(range & 0xff);
+	return true;
+}
+
+struct ChunkReadOrder {
+	inline bool operator< ( const ChunkReadOrder &rhs ) const {
+		if( region.x != rhs.region.x )
+			return region.x < rhs.region.x;
+		if( region.y != rhs.region.y )
+			return region.y < rhs.region.y;
+		return sector < rhs.sector;
+	}
+	Coords2D region;
+	uint32_t sector;
+	Coords2D chunk;
+};
+
+void MCRegionMap::prefetchChunks( std::vector< Coords2D > &chunks ) {
+	RegionTableReader reader( &activeReaders );
+	std::vector< ChunkReadOrder > order;
+	order.reserve( chunks.size() );
+
+	RegionDesc *rg = NULL;
+	RegionHeader *header = NULL;
+	for( std::vector< Coords2D >::iterator it = chunks.begin(); it != chunks.end(); ++it ) {
+		ChunkReadOrder ch = { { toRegionCoord(it->x), toRegionCoord(it->y) }, 0, *it };
+		if( !rg || rg->coords.x != ch.region.x || rg->coords.y != ch.region.y ) {
+			releaseHeader( header );
+			header = NULL;
+			rg = findRegion( ch.region );
+			if( rg )
+				header = acquireHeader( rg );
+		}
+		if( !header )
+			continue;
+
+		ch.sector = header->sectors[((unsigned)it->x&31) + (((unsigned)it->y&31)<<5)];
+		if( ch.sector != 0 )
+			order.push_back( ch );
+	}
+	releaseHeader( header );
+	header = NULL;
+	rg = NULL;
+
+	std::sort( order.begin(), order.end() );
+
+	chunks.clear();
+	for( std::vector< ChunkReadOrder >::iterator it = order.begin(); it != order.end(); ++it ) {
+		if( !rg || rg->coords.x != it->region.x || rg->coords.y != it->region.y ) {
+			releaseHeader( header );
+			header = NULL;
+			rg = findRegion( it->region );
+			if( rg )
+				header = acquireHeader( rg );
+		}
+		if( header ) {
+			header->map.willNeed( (size_t)(it->sector >> 8) << 12, (size_t)(it->sector & 0xff) << 12 );
+			chunks.push_back( it->chunk );
+		}
 	}
-	return NULL;
+	releaseHeader( header );
 }
 
 void MCRegionMap::exploreDirectories() {
@@ -132,20 +305,38 @@ void MCRegionMap::exploreDirectories() {
 			if( abs(regionX) > 0x0001ffff || abs(regionY) > 0x0001ffff )
 				continue;
 			Coords2D rgCoords = { regionX, regionY };
+			uint64_t fileTime = 0, fileSize = 0;
+			bool stamped = find.stamp( fileTime, fileSize );
 
-			RegionMap::iterator it = regions.find( rgCoords );
-			if( it != regions.end() ) {
+			RegionDesc *rg = findRegion( rgCoords );
+			if( rg ) {
 				// Reloading regions after level.dat update
-				if( it->second.chunkTimes ) {
+				// Nothing needs reading again unless the file changed
+				if( stamped && fileTime == rg->fileTime && fileSize == rg->fileSize )
+					continue;
+				rg->fileTime = fileTime;
+				rg->fileSize = fileSize;
+				// Only this thread replaces published headers
+				if( SDL_AtomicGetPtr( (void**)&rg->header ) ) {
 					// The region is loaded - check it for changes
-					checkRegionForChanges( regionX, regionY, &it->second );
+					checkRegionForChanges( rg );
+				} else {
+					readChunkMask( rg );
 				}
 			} else {
 				// New undiscovered region
-				RegionDesc rg;
-				rg.chunkTimes = NULL;
-				rg.sectors = NULL;
-				regions[rgCoords] = rg;
+				rg = new RegionDesc;
+				rg->coords = rgCoords;
+				rg->header = NULL;
+				rg->headerLock = 0;
+				rg->retired = false;
+				rg->fileTime = fileTime;
+				rg->fileSize = fileSize;
+				readChunkMask( rg );
+				RegionDesc **bucket = &regionBuckets[hashRegionCoords( rgCoords )];
+				rg->next = *bucket;
+				SDL_AtomicSetPtr( (void**)bucket, rg );
+				nRegions++;
 
 				if( rgCoords.x < minRgX )
 					minRgX = rgCoords.x;
@@ -158,46 +349,74 @@ void MCRegionMap::exploreDirectories() {
 			}
 		} while((file = find.next()) != NULL);
 	}
+
+	reclaimIfIdle();
 }
 
 void MCRegionMap::flushRegionSectors() {
-	for( RegionMap::iterator it = regions.begin(); it != regions.end(); ++it ) {
-		delete[] it->second.chunkTimes;
-		it->second.chunkTimes = NULL;
-		delete[] it->second.sectors;
-		it->second.sectors = NULL;
+	// Workers may still be walking the old descriptors, so they are retired
+	// rather than deleted
+	for( unsigned i = 0; i < (1u << REGION_BUCKET_SHIFT); i++ ) {
+		RegionDesc *rg = regionBuckets[i];
+		SDL_AtomicSetPtr( (void**)&regionBuckets[i], NULL );
+		for( ; rg; rg = rg->next ) {
+			SDL_AtomicLock( &rg->headerLock );
+			RegionHeader *header = rg->header;
+			rg->header = NULL;
+			rg->retired = true;
+			SDL_AtomicUnlock( &rg->headerLock );
+			releaseHeader( header );
+			retiredRegions.push_back( rg );
+		}
 	}
-	regions.clear();
+	nRegions = 0;
 }
 
-void MCRegionMap::checkRegionForChanges( int x, int y, RegionDesc *region ) {
-	Coords2D c = { x, y };
+void MCRegionMap::reclaimRetiredRegions() {
+	if( SDL_TryLockMutex( rgDescMutex ) != 0 )
+		return;
+	reclaimIfIdle();
+	SDL_mutexV( rgDescMutex );
+}
 
-	char regionfn[MAX_PATH];
-	snprintf( regionfn, MAX_PATH, "%s/region/r.%d.%d.%s", root.c_str(), c.x, c.y, getRegionExt() );
-	FILE *f = fopen( regionfn, "rb" );
+void MCRegionMap::reclaimIfIdle() {
+	// Retired descriptors are no longer in the buckets, so a reader which
+	// starts after this check can't reach them
+	if( !retiredRegions.empty() && SDL_AtomicGet( &activeReaders ) == 0 )
+		deleteRetiredRegions();
+}
 
-	if( !f ) {
-		// ... what just happened?
-		delete[] region->chunkTimes;
-		region->chunkTimes = NULL;
-		delete[] region->sectors;
-		region->sectors = NULL;
-		return;
+void MCRegionMap::deleteRetiredRegions() {
+	for( std::vector< RegionDesc* >::iterator it = retiredRegions.begin(); it != retiredRegions.end(); ++it )
+		delete *it;
+	retiredRegions.clear();
+}
+
+void MCRegionMap::checkRegionForChanges( RegionDesc *region ) {
+	const Coords2D &c = region->coords;
+
+	// Chunks may have been appended to the file, so map it again
+	RegionHeader *header = loadRegionHeader( c );
+
+	// Section ranges stay valid for chunks which were not rewritten
+	RegionHeader *current = (RegionHeader*)SDL_AtomicGetPtr( (void**)&region->header );
+	if( header && current ) {
+		for( unsigned i = 0; i < 1024; i++ ) {
+			if( header->sectors[i] == current->sectors[i] && header->chunkTimes[i] == current->chunkTimes[i] )
+				SDL_AtomicSet( &header->sectionRanges[i], SDL_AtomicGet( &current->sectionRanges[i] ) );
+		}
 	}
 
-	fseek( f, 0, SEEK_SET );
-	fread( region->sectors, 4, 1024, f );
+	SDL_AtomicLock( &region->headerLock );
+	RegionHeader *oldHeader = region->header;
+	region->header = header;
+	SDL_AtomicUnlock( &region->headerLock );
+	setChunkMask( region, header ? &header->sectors[0] : NULL );
 
-	for( unsigned i = 0; i < 1024; i++ ) {
-		unsigned newTime;
-		fread( &newTime, 4, 1, f );
-		newTime = bswap_from_big( newTime );
-		region->sectors[i] = bswap_from_big( region->sectors[i] );
-		if( region->chunkTimes[i] < newTime ) {
-			// Updated chunk!
-			region->chunkTimes[i] = newTime;
-			if( listener ) {
+	if( header && oldHeader && listener ) {
+		for( unsigned i = 0; i < 1024; i++ ) {
+			if( oldHeader->chunkTimes[i] < header->chunkTimes[i] ) {
+				// Updated chunk!
 				int x = (c.x<<5)+(int)(i&31);
 				int y = (c.y*32)+(int)(i>>5);
 				listener->chunkChanged( y, x );
@@ -205,48 +424,126 @@ void MCRegionMap::checkRegionForChanges( int x, int y, RegionDesc *region ) {
 		}
 	}
 
-	fclose( f );
+	releaseHeader( oldHeader );
 }
 
-bool MCRegionMap::getChunkInfo( int x, int y, unsigned &updTime ) {
-	SDL_mutexP( rgDescMutex );
+void MCRegionMap::readChunkMask( RegionDesc *region ) {
+	char regionfn[MAX_PATH];
+	snprintf( regionfn, MAX_PATH, "%s/region/r.%d.%d.%s", root.c_str(), region->coords.x, region->coords.y, getRegionExt() );
 
-	Coords2D c = { toRegionCoord(x), toRegionCoord(y) };
-	RegionMap::iterator it = regions.find( c );
-	if( it == regions.end() ) {
-		SDL_mutexV( rgDescMutex );
-		return false;
+	// Only the sector table is needed
+	uint32_t sectors[1024];
+	FILE *f = fopen( regionfn, "rb" );
+	bool ok = f && fread( &sectors[0], 4, 1024, f ) == 1024;
+	if( f )
+		fclose( f );
+	if( ok ) {
+		for( unsigned i = 0; i < 1024; i++ )
+			sectors[i] = bswap_from_big( sectors[i] );
 	}
+	setChunkMask( region, ok ? &sectors[0] : NULL );
+}
 
-	if( !it->second.chunkTimes ) {
-		char regionfn[MAX_PATH];
-		snprintf( regionfn, MAX_PATH, "%s/region/r.%d.%d.%s", root.c_str(), c.x, c.y, getRegionExt() );
-		FILE *f = fopen( regionfn, "rb" );
-
-		if( !f ) {
-			SDL_mutexV( rgDescMutex );
-			return false;
+void MCRegionMap::setChunkMask( RegionDesc *region, const uint32_t *sectors ) {
+	for( unsigned y = 0; y < 32; y++ ) {
+		uint32_t row = 0;
+		if( sectors ) {
+			for( unsigned x = 0; x < 32; x++ ) {
+				if( sectors[x + (y<<5)] >> 8 )
+					row |= 1u << x;
+			}
 		}
+		SDL_AtomicSet( &region->chunkMask[y], (int)row );
+	}
+}
 
-		it->second.chunkTimes = new uint32_t[1024];
-		it->second.sectors = new uint32_t[1024];
-		fseek( f, 0, SEEK_SET );
-		fread( it->second.sectors, 4, 1024, f );
-		fread( it->second.chunkTimes, 4, 1024, f );
-		fclose( f );
+bool MCRegionMap::hasChunksIn( int minx, int maxx, int miny, int maxy ) {
+	RegionTableReader reader( &activeReaders );
+	for( int ry = toRegionCoord( miny ); ry <= toRegionCoord( maxy ); ry++ ) {
+		for( int rx = toRegionCoord( minx ); rx <= toRegionCoord( maxx ); rx++ ) {
+			Coords2D c = { rx, ry };
+			RegionDesc *rg = findRegion( c );
+			if( !rg )
+				continue;
 
-		for( unsigned i = 0; i < 1024; i++ ) {
-			it->second.chunkTimes[i] = bswap_from_big( it->second.chunkTimes[i] );
-			it->second.sectors[i] = bswap_from_big( it->second.sectors[i] );
+			unsigned x0 = (unsigned)std::max( minx, rx << 5 ) & 31;
+			unsigned x1 = (unsigned)std::min( maxx, (rx << 5) + 31 ) & 31;
+			unsigned y0 = (unsigned)std::max( miny, ry << 5 ) & 31;
+			unsigned y1 = (unsigned)std::min( maxy, (ry << 5) + 31 ) & 31;
+			uint32_t rowMask = (x1 == 31 ? 0xffffffffu : (1u << (x1 + 1)) - 1) & ~((1u << x0) - 1);
+			for( unsigned y = y0; y <= y1; y++ ) {
+				if( (uint32_t)SDL_AtomicGet( &rg->chunkMask[y] ) & rowMask )
+					return true;
+			}
 		}
 	}
+	return false;
+}
 
-	unsigned i = ((unsigned)x&31) + (((unsigned)y&31)<<5);
-	updTime = it->second.chunkTimes[i];
+MCRegionMap::RegionDesc *MCRegionMap::findRegion( const Coords2D &c ) {
+	RegionDesc *rg = (RegionDesc*)SDL_AtomicGetPtr( (void**)&regionBuckets[hashRegionCoords( c )] );
+	while( rg && (rg->coords.x != c.x || rg->coords.y != c.y) )
+		rg = rg->next;
+	return rg;
+}
 
-	SDL_mutexV( rgDescMutex );
-	return it->second.sectors[i] != 0;
-	//return updTime != 0; // Apparently the timestamps are unreliable. This punches holes in the world.
+MCRegionMap::RegionHeader *MCRegionMap::acquireHeader( RegionDesc *region ) {
+	SDL_AtomicLock( &region->headerLock );
+	RegionHeader *header = region->header;
+	if( header )
+		SDL_AtomicIncRef( &header->refs );
+	SDL_AtomicUnlock( &region->headerLock );
+	if( header )
+		return header;
+
+	// First touch - the header is read without holding any lock
+	header = loadRegionHeader( region->coords );
+	if( !header )
+		return NULL;
+	SDL_AtomicSet( &header->refs, 2 );
+
+	SDL_AtomicLock( &region->headerLock );
+	RegionHeader *published = region->header;
+	bool retired = region->retired;
+	if( published ) {
+		// Another worker got here first
+		SDL_AtomicIncRef( &published->refs );
+	} else if( !retired ) {
+		region->header = header;
+	}
+	SDL_AtomicUnlock( &region->headerLock );
+
+	if( published || retired ) {
+		delete header;
+		return published;
+	}
+	return header;
+}
+
+MCRegionMap::RegionHeader *MCRegionMap::loadRegionHeader( const Coords2D &c ) {
+	char regionfn[MAX_PATH];
+	snprintf( regionfn, MAX_PATH, "%s/region/r.%d.%d.%s", root.c_str(), c.x, c.y, getRegionExt() );
+
+	RegionHeader *header = new RegionHeader;
+	if( !header->map.open( regionfn ) || header->map.getSize() < 8192 ) {
+		delete header;
+		return NULL;
+	}
+
+	memcpy( &header->sectors[0], header->map.getData(), 4096 );
+	memcpy( &header->chunkTimes[0], header->map.getData() + 4096, 4096 );
+	for( unsigned i = 0; i < 1024; i++ ) {
+		header->sectors[i] = bswap_from_big( header->sectors[i] );
+		header->chunkTimes[i] = bswap_from_big( header->chunkTimes[i] );
+		SDL_AtomicSet( &header->sectionRanges[i], 0 );
+	}
+	SDL_AtomicSet( &header->refs, 1 );
+	return header;
+}
+
+void MCRegionMap::releaseHeader( RegionHeader *header ) {
+	if( header && SDL_AtomicDecRef( &header->refs ) )
+		delete header;
 }
 
 int MCRegionMap::updateScanner( void *rgMapCookie ) {
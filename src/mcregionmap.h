@@ -25,10 +25,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #define MCREGIONMAP_H
 
 #include <string>
+#include <vector>
 #include <SDL.h>
 
 #include "luaobject.h"
-#include "nbt.h"
+#include "mappedfile.h"
+#include "nbtdoc.h"
 
 struct Coords2D {
 	inline bool operator< ( const Coords2D &rhs ) const {
@@ -73,17 +75,31 @@ public:
 
 	void getWorldChunkExtents( int &minx, int &maxx, int &miny, int &maxy );
 	void getWorldBlockExtents( int &minx, int &maxx, int &miny, int &maxy );
-	inline unsigned getTotalRegionCount() const { return (unsigned)regions.size(); }
+	inline unsigned getTotalRegionCount() const { return nRegions; }
 
 	// x and y are in chunk coords (that is, blockxy/16)
 	// The function is reentrant
-	nbt::Compound *readChunk( int x, int y );
+	// Only the tags listed in schema are decoded if it is not NULL
+	nbt::Document *readChunk( int x, int y, const nbt::Schema *schema = NULL );
+	// Finds the lowest and highest section Y of an Anvil chunk, parsing
+	// only the section heights; results are kept with the region header
+	// Returns false if the chunk does not exist or has no sections
+	bool getChunkSectionRange( int x, int y, int &minSection, int &maxSection );
+	// Whether any chunk exists in the range, going by the region headers
+	// Cheap enough to call before deciding whether to mesh an area
+	bool hasChunksIn( int minx, int maxx, int miny, int maxy );
+	// Drops the chunks which do not exist, sorts the rest by their
+	// position on disk and starts reading them in the background
+	void prefetchChunks( std::vector< Coords2D > &chunks );
 
 	void changeRoot( const char *newRoot, bool anvil = true );
 	const std::string &getRoot() const { return root; }
 	bool isAnvil() const { return anvil; }
 
 	void checkForRegionChanges();
+	// Frees the descriptors dropped by changeRoot if no thread is inside
+	// one of the lookups above; does nothing if the scanner holds the table
+	void reclaimRetiredRegions();
 	inline void setListener( ChangeListener *l ) { listener = l; }
 
 	// Lua functions
@@ -97,15 +113,50 @@ public:
 	static void setupLua( lua_State *L );
 
 private:
+	// Header snapshots are immutable once published, and are kept alive
+	// by their reference count while workers read from the mapping
+	struct RegionHeader {
+		MappedFile map;
+		uint32_t sectors[1024];
+		uint32_t chunkTimes[1024];
+		// Filled in lazily by getChunkSectionRange
+		SDL_atomic_t sectionRanges[1024];
+		SDL_atomic_t refs;
+	};
+	enum {
+		SECTION_RANGE_KNOWN = 0x10000,
+		SECTION_RANGE_EMPTY = 0x20000
+	};
+
+	// Descriptors are never removed from the table while it is in use;
+	// readers walk the buckets without taking rgDescMutex
 	struct RegionDesc {
-		uint32_t *sectors;
-		uint32_t *chunkTimes;
+		Coords2D coords;
+		RegionDesc *next;
+		RegionHeader *header;
+		SDL_SpinLock headerLock;
+		bool retired;
+		// Region file stamp when it was last read; only the scanner uses these
+		uint64_t fileTime, fileSize;
+		// Bit x of word y is set if the chunk at (x,y) in the region exists
+		SDL_atomic_t chunkMask[32];
 	};
 
 	void exploreDirectories();
 	void flushRegionSectors();
-	void checkRegionForChanges( int x, int y, RegionDesc *region );
-	bool getChunkInfo( int x, int y, unsigned &updTime );
+	void reclaimIfIdle();
+	void deleteRetiredRegions();
+	void checkRegionForChanges( RegionDesc *region );
+	RegionDesc *findRegion( const Coords2D &c );
+	RegionHeader *acquireHeader( RegionDesc *region );
+	RegionHeader *loadRegionHeader( const Coords2D &c );
+	void readChunkMask( RegionDesc *region );
+	static void setChunkMask( RegionDesc *region, const uint32_t *sectors );
+	nbt::Document *readChunkFrom( RegionHeader *header, int x, int y, const nbt::Schema *schema );
+	static void releaseHeader( RegionHeader *header );
+	static inline unsigned hashRegionCoords( const Coords2D &c ) {
+		return (((unsigned)c.x * 0x9e3779b1u) ^ ((unsigned)c.y * 0x85ebca6bu)) >> (32 - REGION_BUCKET_SHIFT);
+	}
 
 	static int updateScanner( void *rgMapCookie );
 	const char *getRegionExt() const { return anvil ? "mca" : "mcr"; }
@@ -114,11 +165,16 @@ private:
 	bool anvil;
 
 	int minRgX, maxRgX, minRgY, maxRgY;
-	typedef std::map< Coords2D, RegionDesc > RegionMap;
-	RegionMap regions;
+	enum { REGION_BUCKET_SHIFT = 12 };
+	RegionDesc *regionBuckets[1 << REGION_BUCKET_SHIFT];
+	unsigned nRegions;
+	std::vector< RegionDesc* > retiredRegions;
+	// Threads inside readChunk, getChunkSectionRange, hasChunksIn or
+	// prefetchChunks, which may still hold a retired descriptor
+	SDL_atomic_t activeReaders;
 
 	SDL_Thread *changeThread;
-	SDL_mutex *rgDescMutex;
+	SDL_mutex *rgDescMutex; // Held by whoever modifies the region table
 	ChangeListener *listener;
 	bool watchUpdates;
 };
@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <cassert>
 #include <GL/glew.h>
 #include "mcworldmesh.h"
+#include "blockvolume.h"
 #include "mcmap.h"
 #include "blockmaterial.h"
 #include "mcbiome.h"
@@ -66,6 +67,12 @@ public:
 	~IslandHole()
 	{ }
 
+	void reset( bool firstPointVisible ) {
+		firstBlockIsNonVisible = !firstPointVisible;
+		contourBlocks.clear();
+		contourPoints.clear();
+	}
+
 	const mcgeom::Point &insidePoint() const { return inside; }
 	mcgeom::Point &insidePoint() { return inside; }
 	std::vector< mcgeom::Point > &blocks() { return contourBlocks; }
@@ -93,10 +100,69 @@ private:
 	std::vector< mcgeom::Point > contourPoints;
 };
 
+// Memory which a mesh worker reuses from one mesh to the next
+// The MeshBuilder using it holds it until the mesh is finalized
+class MeshScratch {
+public:
+	MeshScratch()
+		: blockInfo(NULL), lightingTex(NULL), capacity(0)
+	{ }
+	~MeshScratch() {
+		trim();
+	}
+
+	// blockInfo is kept zeroed between meshes; every cell of lightingTex
+	// is written by the lighting pass, so it is never cleared
+	void reserve( unsigned size ) {
+		if( size > capacity ) {
+			delete[] blockInfo;
+			delete[] lightingTex;
+			blockInfo = new unsigned short[size]();
+			lightingTex = new unsigned char[size<<1];
+			capacity = size;
+		}
+	}
+
+	// Gives all of the memory back
+	void trim() {
+		delete[] blockInfo;
+		delete[] lightingTex;
+		blockInfo = NULL;
+		lightingTex = NULL;
+		capacity = 0;
+		vol.release();
+		std::vector< mcgeom::Point >().swap( contourBlocks );
+		std::vector< mcgeom::Point >().swap( contourPoints );
+		std::vector< mcgeom::Point >().swap( glows );
+		std::vector< uint64_t >().swap( exposedMask );
+		std::vector< unsigned short >().swap( dirtyLo );
+		std::vector< unsigned short >().swap( dirtyHi );
+		holes.clear();
+		spareHoles.clear();
+	}
+
+	unsigned short *blockInfo;
+	unsigned char *lightingTex;
+	unsigned capacity;
+	// The z range of blockInfo written in each column, lo > hi if clean
+	std::vector< unsigned short > dirtyLo, dirtyHi;
+
+	BlockVolume vol;
+	std::vector< mcgeom::Point > contourBlocks;
+	std::vector< mcgeom::Point > contourPoints;
+	std::vector< mcgeom::Point > glows;
+	std::list< IslandHole > holes, spareHoles;
+	std::vector< uint64_t > exposedMask;
+
+private:
+	MeshScratch( const MeshScratch& );
+	MeshScratch &operator=( const MeshScratch& );
+};
+
 class MeshBuilder {
 public:
-	MeshBuilder( const Extents &pow2Ext, const Extents &hullExt, const MCBlockDesc *blockDesc )
-		: biomeCoords(NULL), pow2Ext(pow2Ext), hullExt(hullExt), blockDesc(blockDesc)
+	MeshBuilder( const Extents &pow2Ext, const Extents &hullExt, const MCBlockDesc *blockDesc, MeshScratch &scratch )
+		: biomeCoords(NULL), pow2Ext(pow2Ext), hullExt(hullExt), scratch(scratch), blockDesc(blockDesc)
 	{
 		sizex = (unsigned)(pow2Ext.maxx-pow2Ext.minx+1);
 		sizey = (unsigned)(pow2Ext.maxy-pow2Ext.miny+1);
@@ -105,11 +171,20 @@ public:
 		shifty = getPow2( sizey );
 		shiftz = getPow2( sizez );
 		totalSize = 1u << (shiftx + shifty + shiftz);
-		blockInfo = new unsigned short[totalSize];
-		memset( blockInfo, 0, totalSize<<1 );
 
-		lightingTex = new unsigned char[totalSize<<1];
-		memset( lightingTex, 0, totalSize<<1 );
+		scratch.reserve( totalSize );
+		blockInfo = scratch.blockInfo;
+		unsigned nColumns = totalSize >> shiftz;
+		if( scratch.dirtyLo.size() < nColumns ) {
+			scratch.dirtyLo.resize( nColumns, 0xffff );
+			scratch.dirtyHi.resize( nColumns, 0 );
+		}
+
+		lightingTex = scratch.lightingTex;
+		if( sizex != 1u << shiftx || sizey != 1u << shifty || sizez != 1u << shiftz ) {
+			// The lighting pass only covers every texel of power of two sizes
+			memset( lightingTex, 0, totalSize<<1 );
+		}
 
 		for( unsigned i = 0; i < BLOCK_ID_COUNT; i++ )
 			geomStreams[i] = NULL;
@@ -120,17 +195,39 @@ public:
 	}
 
 	~MeshBuilder() {
-		delete[] blockInfo;
-		delete[] lightingTex;
+		clearHoles();
+	}
+
+	// Zeroes the parts of blockInfo the islands wrote to, for the next mesh
+	void clearBlockInfo() {
+		unsigned nColumns = totalSize >> shiftz;
+		for( unsigned c = 0; c < nColumns; c++ ) {
+			unsigned short lo = scratch.dirtyLo[c], hi = scratch.dirtyHi[c];
+			if( lo <= hi ) {
+				memset( blockInfo + (c << shiftz) + lo, 0, (hi - lo + 1) * sizeof(unsigned short) );
+				scratch.dirtyLo[c] = 0xffff;
+				scratch.dirtyHi[c] = 0;
+			}
+		}
 	}
 
 	const Extents *getExtents() { return &hullExt; }
 	const Extents *getLightExtents() { return &pow2Ext; }
 	const MCBlockDesc *getBlockDesc() { return blockDesc; }
+	BlockVolume &getVolume() { return scratch.vol; }
+	std::vector< mcgeom::Point > &getContourBlocks() { return scratch.contourBlocks; }
+	std::vector< mcgeom::Point > &getContourPoints() { return scratch.contourPoints; }
+	uint64_t *getExposedMask( unsigned words ) {
+		if( scratch.exposedMask.size() < words )
+			scratch.exposedMask.resize( words );
+		return &scratch.exposedMask[0];
+	}
 
 	void markDone( const mcgeom::Point &pt, unsigned dir ) { markDone(pt.x,pt.y,pt.z,dir); }
 	void markDone( int x, int y, int z, unsigned dir ) {
-		blockInfo[toLinCoord(x,y,z)] |= (unsigned char)(1<<dir);
+		unsigned i = toLinCoord(x,y,z);
+		markDirty( i );
+		blockInfo[i] |= (unsigned char)(1<<dir);
 	}
 	bool isDone( const mcgeom::Point &pt, unsigned dir ) { return isDone(pt.x,pt.y,pt.z,dir); }
 	bool isDone( int x, int y, int z, unsigned dir ) {
@@ -138,7 +235,9 @@ public:
 	}
 	void flagEdge( const mcgeom::Point &pt, unsigned dir ) { flagEdge(pt.x,pt.y,pt.z,dir); }
 	void flagEdge( int x, int y, int z, unsigned dir ) {
-		blockInfo[toLinCoord(x,y,z)] |= 1u << (dir+8);
+		unsigned i = toLinCoord(x,y,z);
+		markDirty( i );
+		blockInfo[i] |= 1u << (dir+8);
 	}
 	unsigned isEdgeFlagged( const mcgeom::Point &pt, unsigned dir ) { return isEdgeFlagged(pt.x,pt.y,pt.z,dir); }
 	unsigned isEdgeFlagged( int x, int y, int z, unsigned dir ) {
@@ -281,14 +380,20 @@ public:
 	}
 
 	IslandHole *newHole( bool visible ) {
-		holes.push_back( IslandHole(visible) );
+		std::list< IslandHole > &holes = scratch.holes;
+		if( scratch.spareHoles.empty() ) {
+			holes.push_back( IslandHole(visible) );
+		} else {
+			holes.splice( holes.end(), scratch.spareHoles, scratch.spareHoles.begin() );
+			holes.back().reset( visible );
+		}
 		return &holes.back();
 	}
 	void clearHoles() {
-		holes.clear();
+		scratch.spareHoles.splice( scratch.spareHoles.end(), scratch.holes );
 	}
 	std::list< IslandHole > &getHoles() {
-		return holes;
+		return scratch.holes;
 	}
 
 	inline void toLocalSpace( mcgeom::Point &pt ) {
@@ -302,6 +407,7 @@ public:
 	}
 
 	void transformHolesToLocalSpace() {
+		std::list< IslandHole > &holes = scratch.holes;
 		for( std::list< IslandHole >::iterator it = holes.begin(); it != holes.end(); ++it ) {
 			toLocalSpace( it->blocks() );
 			toLocalSpace( it->points() );
@@ -310,6 +416,7 @@ public:
 	}
 
 	unsigned gatherHoleContourPoints( unsigned *&ends, mcgeom::Point *&points, mcgeom::Point *&inside ) {
+		const std::list< IslandHole > &holes = scratch.holes;
 		ends = new unsigned[holes.size()];
 		inside = new mcgeom::Point[holes.size()];
 		unsigned pointCount = 0, n = 0;
@@ -340,6 +447,20 @@ public:
 		return n;
 	}
 
+	// The first write to each texel; later ones only raise the light
+	inline void storeLightingAt( int x, int y, int z, unsigned block, unsigned sky ) {
+		unsigned i = toLLinCoord(x,y,z) << 1;
+		lightingTex[i] = (unsigned char)(block<<4);
+		lightingTex[i+1] = (unsigned char)(sky<<4);
+	}
+	// Columns which don't exist are dark
+	void clearLightingColumn( int x, int y ) {
+		for( int z = pow2Ext.minz; z <= pow2Ext.maxz; z++ )
+			storeLightingAt( x, y, z, 0, 0 );
+	}
+	// Glowing blocks light their neighbours after every column is stored
+	std::vector< mcgeom::Point > &getGlows() { return scratch.glows; }
+
 	inline void setLightingAt( int x, int y, int z, unsigned block, unsigned sky ) {
 		unsigned i = toLLinCoord(x,y,z) << 1;
 		lightingTex[i] = std::max( lightingTex[i], (unsigned char)(block<<4) );
@@ -364,6 +485,15 @@ private:
 		return 0;
 	}
 
+	inline void markDirty( unsigned i ) {
+		unsigned c = i >> shiftz;
+		unsigned short z = (unsigned short)(i & ((1u << shiftz) - 1));
+		if( z < scratch.dirtyLo[c] )
+			scratch.dirtyLo[c] = z;
+		if( z > scratch.dirtyHi[c] )
+			scratch.dirtyHi[c] = z;
+	}
+
 	inline unsigned toLinCoord( int x, int y, int z ) {
 		return (unsigned)(z-pow2Ext.minz) + ((unsigned)(x-pow2Ext.minx)<<shiftz) + ((unsigned)(y-pow2Ext.miny)<<(shiftz+shiftx));
 	}
@@ -385,7 +515,7 @@ private:
 	unsigned char *lightingTex;
 	Extents pow2Ext, hullExt;
 
-	std::list< IslandHole > holes;
+	MeshScratch &scratch;
 
 	const MCBlockDesc *blockDesc;
 };
@@ -425,7 +555,23 @@ static void adjustStartingPointAlongAxis( mcgeom::Point &pos, bool adjust, unsig
 }
 */
 
-static bool scanContourAndFlag( MeshBuilder &bld, mcgeom::IslandDesc *island, MCMap *map, const mcgeom::Point &start, unsigned startDir, std::vector< mcgeom::Point > &contourBlocks, std::vector< mcgeom::Point > &contourPoints ) {
+static bool isFaceHidden( MeshBuilder &bld, const mcgeom::IslandDesc *island, const BlockVolume &vol, const BlockVolume::Column &col, mcgeom::Point pos ) {
+	if( !(island->checkVisibility | island->checkFacingSameId) )
+		return false;
+
+	unsigned short facingId;
+	if( island->zax == 2 ) {
+		facingId = (unsigned short)col.getId( pos.z + island->zd );
+	} else {
+		pos.v[island->zax] += island->zd;
+		if( !vol.getBlockID( pos.x, pos.y, pos.z, facingId ) )
+			return true;
+	}
+	return (island->checkFacingSameId && facingId == island->origin.block.id) ||
+		(island->checkVisibility && bld.getBlockDesc()->getSolidity( facingId, island->islandAxis ));
+}
+
+static bool scanContourAndFlag( MeshBuilder &bld, mcgeom::IslandDesc *island, const BlockVolume &vol, const mcgeom::Point &start, unsigned startDir, std::vector< mcgeom::Point > &contourBlocks, std::vector< mcgeom::Point > &contourPoints ) {
 
 	mcgeom::Point pos = start;
 	mcgeom::Point contourPt = pos;
@@ -467,8 +613,8 @@ static bool scanContourAndFlag( MeshBuilder &bld, mcgeom::IslandDesc *island, MC
 			goto dont_continue_island;
 
 		// Does the map exist here? Does the block have the same id?
-		MCMap::Column nextCol;
-		if( !map->getColumn( nextPos.x, nextPos.y, nextCol ) ||
+		BlockVolume::Column nextCol;
+		if( !vol.getColumn( nextPos.x, nextPos.y, nextCol ) ||
 			nextCol.getId( nextPos.z ) != island->origin.block.id )
 			goto dont_continue_island;
 
@@ -485,22 +631,8 @@ static bool scanContourAndFlag( MeshBuilder &bld, mcgeom::IslandDesc *island, MC
 		}
 
 		// Is the block visible?
-		if( island->checkVisibility | island->checkFacingSameId ) {
-			unsigned short facingId;
-			if( island->zax == 2 ) {
-				facingId = (unsigned short)nextCol.getId( nextPos.z + island->zd );
-			} else {
-				nextPos.v[island->zax] += island->zd;
-				if( !map->getBlockID( nextPos.x, nextPos.y, nextPos.z, facingId ) )
-					// Invisible - skip the block
-					goto dont_continue_island;
-				nextPos.v[island->zax] -= island->zd;
-			}
-			if( (island->checkFacingSameId && facingId == island->origin.block.id) ||
-				(island->checkVisibility && bld.getBlockDesc()->getSolidity( facingId, island->islandAxis )) )
-				// Invisible - skip the block
-				goto dont_continue_island;
-		}
+		if( isFaceHidden( bld, island, vol, nextCol, nextPos ) )
+			goto dont_continue_island;
 
 		// Continue the island
 		lastDir = islDir;
@@ -552,7 +684,7 @@ dont_continue_island:
 	return true;
 }
 
-static void holeScan( MeshBuilder &bld, mcgeom::IslandDesc *island, MCMap *map, const mcgeom::Point &start, unsigned dir ) {
+static void holeScan( MeshBuilder &bld, mcgeom::IslandDesc *island, const BlockVolume &vol, const mcgeom::Point &start, unsigned dir ) {
 	// First check if the starting position has overlapping flags
 	// This takes care of the case where the island has 1-square wide sections
 	if( bld.isEdgeFlagged( start, dir ) )
@@ -571,8 +703,8 @@ static void holeScan( MeshBuilder &bld, mcgeom::IslandDesc *island, MCMap *map,
 			break; // Hit the other side!
 
 		// Does the map exist here?
-		MCMap::Column nextCol;
-		if( !map->getColumn( nextPos.x, nextPos.y, nextCol ) ) {
+		BlockVolume::Column nextCol;
+		if( !vol.getColumn( nextPos.x, nextPos.y, nextCol ) ) {
 			holeIsVisible = false;
 			goto its_a_hole;
 		}
@@ -584,7 +716,7 @@ static void holeScan( MeshBuilder &bld, mcgeom::IslandDesc *island, MCMap *map,
 				facingId = (unsigned short)nextCol.getId( nextPos.z + island->zd );
 			} else {
 				nextPos.v[island->zax] += island->zd;
-				if( !map->getBlockID( nextPos.x, nextPos.y, nextPos.z, facingId ) ) {
+				if( !vol.getBlockID( nextPos.x, nextPos.y, nextPos.z, facingId ) ) {
 					// Hit the outside - should never happen in current maps
 					holeIsVisible = false;
 					goto its_a_hole;
@@ -626,10 +758,10 @@ its_a_hole:
 	// It's a hole!!
 	IslandHole *hole = bld.newHole( holeIsVisible );
 	hole->insidePoint() = nextPos;
-	scanContourAndFlag( bld, island, map, pos, (dir+1)&3, hole->blocks(), hole->points() );
+	scanContourAndFlag( bld, island, vol, pos, (dir+1)&3, hole->blocks(), hole->points() );
 }
 
-static void searchForHoles( MeshBuilder &bld, mcgeom::IslandDesc *island, MCMap *map, const std::vector< mcgeom::Point > &contourBlocks ) {
+static void searchForHoles( MeshBuilder &bld, mcgeom::IslandDesc *island, const BlockVolume &vol, const std::vector< mcgeom::Point > &contourBlocks ) {
 	assert( contourBlocks.size() > 1 );
 
 	mcgeom::Point pos = contourBlocks.back();
@@ -652,10 +784,10 @@ static void searchForHoles( MeshBuilder &bld, mcgeom::IslandDesc *island, MCMap
 			dir = (pos.v[island->yax] > dest.v[island->yax]) == (island->yd > 0) ? 1 : 3;
 		}
 		
-		holeScan( bld, island, map, pos, (dir + 1) & 3 );
+		holeScan( bld, island, vol, pos, (dir + 1) & 3 );
 		do {
 			moveCoordsInDir( island, pos.v, dir );
-			holeScan( bld, island, map, pos, (dir + 1) & 3 );
+			holeScan( bld, island, vol, pos, (dir + 1) & 3 );
 		} while( pos != dest );
 	}
 }
@@ -686,10 +818,107 @@ static void unflagContour( MeshBuilder &bld, mcgeom::IslandDesc *island, const s
 	}
 }
 
-static void generateMCMapIslands( MeshBuilder &bld, mcgeom::BlockGeometry *geom, mcgeom::IslandDesc *island, MCMap *map ) {
-	std::vector< mcgeom::Point > contourBlocks;
-	std::vector< mcgeom::Point > contourPoints;
-	std::vector< std::vector< mcgeom::BlockData > > holes;
+static bool canJoinRectIsland( MeshBuilder &bld, const mcgeom::IslandDesc *island, const BlockVolume &vol, const mcgeom::Point &pos ) {
+	if( !bld.getExtents()->contains( pos.x, pos.y, pos.z ) || bld.isDone( pos, island->islandAxis ) )
+		return false;
+
+	BlockVolume::Column col;
+	if( !vol.getColumn( pos.x, pos.y, col ) || col.getId( pos.z ) != island->origin.block.id )
+		return false;
+
+	return !isFaceHidden( bld, island, vol, col, pos );
+}
+
+static void pushRectCorner( std::vector< mcgeom::Point > &points, const mcgeom::Point &pt ) {
+	if( points.empty() || points.back() != pt )
+		points.push_back( pt );
+}
+
+static void generateRectIsland( MeshBuilder &bld, mcgeom::BlockGeometry *geom, mcgeom::GeometryCluster *cluster, mcgeom::IslandDesc *island, const BlockVolume &vol, std::vector< mcgeom::Point > &contourBlocks, std::vector< mcgeom::Point > &contourPoints ) {
+	// Greedily grow a rectangle from the origin, first along the axis which
+	// generateFromMCMap walks innermost, then along the other
+	// Blocks before the origin in that order have been visited already
+	const mcgeom::Point start = island->origin.block.pos;
+	unsigned aax = std::max( island->xax, island->yax );
+	unsigned bax = std::min( island->xax, island->yax );
+
+	mcgeom::Point pos = start;
+	int alen = 1;
+	for( pos.v[aax]++; canJoinRectIsland( bld, island, vol, pos ); pos.v[aax]++ )
+		alen++;
+
+	int blen = 1;
+	for( ;; blen++ ) {
+		pos = start;
+		pos.v[bax] += blen;
+		int i = 0;
+		while( i < alen && canJoinRectIsland( bld, island, vol, pos ) ) {
+			pos.v[aax]++;
+			i++;
+		}
+		if( i < alen )
+			break;
+	}
+
+	for( int j = 0; j < blen; j++ ) {
+		pos = start;
+		pos.v[bax] += j;
+		for( int i = 0; i < alen; i++, pos.v[aax]++ )
+			bld.markDone( pos, island->islandAxis );
+	}
+
+	// Output the corners in the order scanContourAndFlag walks them
+	mcgeom::Point hi = start;
+	hi.v[aax] += alen - 1;
+	hi.v[bax] += blen - 1;
+	const mcgeom::Point &lowUBlock = island->xd > 0 ? start : hi;
+	const mcgeom::Point &highUBlock = island->xd > 0 ? hi : start;
+	const mcgeom::Point &lowVBlock = island->yd > 0 ? start : hi;
+	const mcgeom::Point &highVBlock = island->yd > 0 ? hi : start;
+	int lowU = lowUBlock.v[island->xax] + (island->xd < 0 ? 1 : 0);
+	int highU = highUBlock.v[island->xax] + (island->xd > 0 ? 1 : 0);
+	int lowV = lowVBlock.v[island->yax] + (island->yd < 0 ? 1 : 0);
+	int highV = highVBlock.v[island->yax] + (island->yd > 0 ? 1 : 0);
+
+	mcgeom::Point pt = start;
+	if( island->islandAxis & 1 )
+		pt.v[island->zax]++;
+	pt.v[island->xax] = lowU; pt.v[island->yax] = highV;
+	contourPoints.push_back( pt );
+	pt.v[island->yax] = lowV;
+	contourPoints.push_back( pt );
+	pt.v[island->xax] = highU;
+	contourPoints.push_back( pt );
+	pt.v[island->yax] = highV;
+	contourPoints.push_back( pt );
+
+	pt = start;
+	pt.v[island->xax] = lowUBlock.v[island->xax]; pt.v[island->yax] = highVBlock.v[island->yax];
+	pushRectCorner( contourBlocks, pt );
+	pt.v[island->yax] = lowVBlock.v[island->yax];
+	pushRectCorner( contourBlocks, pt );
+	pt.v[island->xax] = highUBlock.v[island->xax];
+	pushRectCorner( contourBlocks, pt );
+	pt.v[island->yax] = highVBlock.v[island->yax];
+	pushRectCorner( contourBlocks, pt );
+	if( contourBlocks.size() > 1 && contourBlocks.front() == contourBlocks.back() )
+		contourBlocks.pop_back();
+
+	bld.toLocalSpace( contourBlocks );
+	bld.toLocalSpace( contourPoints );
+	bld.toLocalSpace( island->origin.block.pos );
+
+	island->nHoles = 0;
+	island->nContourBlocks = (unsigned)contourBlocks.size();
+	island->contourBlocks = &contourBlocks[0];
+	island->nContourPoints = (unsigned)contourPoints.size();
+	island->contourPoints = &contourPoints[0];
+	geom->emitIsland( cluster, island );
+}
+
+static void generateMCMapIslands( MeshBuilder &bld, mcgeom::BlockGeometry *geom, mcgeom::IslandDesc *island, const BlockVolume &vol ) {
+	std::vector< mcgeom::Point > &contourBlocks = bld.getContourBlocks();
+	std::vector< mcgeom::Point > &contourPoints = bld.getContourPoints();
 
 	mcgeom::GeometryCluster *cluster = bld.getGeometryCluster( island->origin.block.id );
 	mcgeom::BlockData oriBlock = island->origin.block;
@@ -775,13 +1004,16 @@ static void generateMCMapIslands( MeshBuilder &bld, mcgeom::BlockGeometry *geom,
 
 		island->checkVisibility &= !bld.getBlockDesc()->shouldHighlight( island->origin.block.id );
 
-		if( scanContourAndFlag( bld, island, map, island->origin.block.pos, 0, contourBlocks, contourPoints ) ) {
+		if( !mode && !island->continueIsland && !island->xslope && !island->yslope && geom->allowsRectIslands() ) {
+			// Plain faces - skip the contour walk and triangulation
+			generateRectIsland( bld, geom, cluster, island, vol, contourBlocks, contourPoints );
+		} else if( scanContourAndFlag( bld, island, vol, island->origin.block.pos, 0, contourBlocks, contourPoints ) ) {
 			if( contourBlocks.size() > 1 ) {
 				if( contourBlocks.size() > 2 ) {
 					// The island has an interior - search for holes
-					searchForHoles( bld, island, map, contourBlocks );
+					searchForHoles( bld, island, vol, contourBlocks );
 					for( std::list< IslandHole >::const_iterator it = bld.getHoles().begin(); it != bld.getHoles().end(); ++it )
-						searchForHoles( bld, island, map, it->blocks() );
+						searchForHoles( bld, island, vol, it->blocks() );
 					// Clean up
 					unflagContour( bld, island, contourBlocks );
 					for( std::list< IslandHole >::const_iterator it = bld.getHoles().begin(); it != bld.getHoles().end(); ++it )
@@ -854,18 +1086,38 @@ static void glowAreaAround( MeshBuilder &bld, int x, int y, int z ) {
 	}
 }
 
-static void lightMapColumn( MeshBuilder &bld, int x, int y, const MCMap::Column &col, const MCMap::Column *sides ) {
+static void lightAirRun( MeshBuilder &bld, int x, int y, const BlockVolume::Column &col, int z0, int z1 ) {
+	const MCBlockDesc *blocks = bld.getBlockDesc();
+	bool blockLighting = blocks->enableBlockLighting();
+	// Override the skylight (for the End)
+	unsigned minSkyLight = blocks->getDefAirSkyLightOverride() ? blocks->getDefAirSkyLight() : 0u;
+	for( int z = z0; z <= z1; z++ )
+		bld.storeLightingAt( x, y, z, blockLighting ? col.getBlockLight( z ) : 0u, std::max( col.getSkyLight( z ), minSkyLight ) );
+}
+
+static void lightMapColumn( MeshBuilder &bld, int x, int y, const BlockVolume::Column &col, const BlockVolume::Column *sides ) {
 	const unsigned AO_HARSHNESS = 4;
 
-	for( int z = bld.getExtents()->minz; z <= bld.getExtents()->maxz; z++ ) {
+	int maxz = bld.getExtents()->maxz;
+	for( int z = bld.getExtents()->minz; z <= maxz; z++ ) {
+		if( z >= col.minZ && z <= col.maxZ && (z < col.bottomZ || z > col.topZ) ) {
+			// Air spans above and below the column's blocks only need their light
+			int runEnd = std::min( std::min( col.maxZ, maxz ), z < col.bottomZ ? col.bottomZ - 1 : col.maxZ );
+			lightAirRun( bld, x, y, col, z, runEnd );
+			z = runEnd;
+			continue;
+		}
+
 		unsigned id = col.getId( z );
 		unsigned blockLight = bld.getBlockDesc()->enableBlockLighting() ? col.getBlockLight( z ) : 0u;
 		unsigned skyLight = col.getSkyLight( z );
-		bld.setLightingAt( x, y, z, blockLight, skyLight );
+		bld.storeLightingAt( x, y, z, blockLight, skyLight );
 
 		if( id > 0 ) {
 			if( bld.getBlockDesc()->shouldHighlight( id ) ) {
-				glowAreaAround( bld, x, y, z );
+				mcgeom::Point pt;
+				pt.x = x; pt.y = y; pt.z = z;
+				bld.getGlows().push_back( pt );
 			} else {
 				// Un-harshen the lighting by letting the light 'seep' into blocks where
 				// it doesn't matter
@@ -930,23 +1182,19 @@ static void lightMapColumn( MeshBuilder &bld, int x, int y, const MCMap::Column
 	}
 }
 
-static void lightMapColumn( MeshBuilder &bld, MCMap *map, int x, int y, unsigned short *allOne ) {
-	MCMap::Column col;
-	if( map->getColumn( x, y, col ) ) {
-		MCMap::Column sides[4];
-		bool sideExists[4];
-		sideExists[0] = map->getColumn( x-1, y, sides[0] );
-		sideExists[1] = map->getColumn( x+1, y, sides[1] );
-		sideExists[2] = map->getColumn( x, y-1, sides[2] );
-		sideExists[3] = map->getColumn( x, y+1, sides[3] );
-		for( unsigned i = 0; i < 4; i++ ) {
-			if( !sideExists[i] ) {
-				sides[i].id = allOne;
-				sides[i].minZ = col.minZ;
-			}
-		}
+static void lightMapColumn( MeshBuilder &bld, const BlockVolume &vol, int x, int y ) {
+	BlockVolume::Column col;
+	if( vol.getColumn( x, y, col ) ) {
+		BlockVolume::Column sides[4];
+		// Missing neighbours are already filled in as solid
+		vol.getColumn( x-1, y, sides[0] );
+		vol.getColumn( x+1, y, sides[1] );
+		vol.getColumn( x, y-1, sides[2] );
+		vol.getColumn( x, y+1, sides[3] );
 
 		lightMapColumn( bld, x, y, col, &sides[0] );
+	} else {
+		bld.clearLightingColumn( x, y );
 	}
 }
 
@@ -960,9 +1208,22 @@ static void outputSignsFromMap( MeshBuilder &bld, MCMap *map, int minx, int maxx
 		char *t = &text[0];
 		unsigned n = sizeof(text);
 		for( unsigned i = 0; i < 4; i++ ) {
-			const wchar_t *s = it->text[i];
-			while( n && *s ) {
-				*t++ = (char)*s++;
+			const unsigned char *s = (const unsigned char*)it->text[i];
+			const unsigned char *e = s + it->textLen[i];
+			while( n && s < e ) {
+				unsigned c = *s++;
+				if( c >= 0x80 ) {
+					// Decode UTF-8 - the font only has Latin-1
+					unsigned extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+					c &= 0x3fu >> extra;
+					for( ; extra && s < e; extra-- )
+						c = (c << 6) | (*s++ & 0x3fu);
+					if( c > 0xff )
+						c = '?';
+				}
+				if( c == 0 )
+					continue;
+				*t++ = (char)c;
 				n--;
 			}
 			if( n ) {
@@ -1006,50 +1267,46 @@ static void outputSignsFromMap( MeshBuilder &bld, MCMap *map, int minx, int maxx
 	}
 }
 
-MCWorldMesh *MCWorldMesh::generateFromMCMap( MCMap *map, const MCBlockDesc *blocks, Extents &hull, Extents &ltext ) {
-	unsigned short *allOne = new unsigned short[hull.maxz - hull.minz + 1];
-	for( int z = hull.minz; z <= hull.maxz; z++ )
-		allOne[z-hull.minz] = 1;
-
-	MeshBuilder *pbld = new MeshBuilder( ltext, hull, blocks );
+MCWorldMesh *MCWorldMesh::generateFromMCMap( MCMap *map, const MCBlockDesc *blocks, Extents &hull, Extents &ltext, MeshScratch *scratch ) {
+	MeshBuilder *pbld = new MeshBuilder( ltext, hull, blocks, *scratch );
 	MeshBuilder &bld = *pbld;
 
+	// The light extents' border columns look one further out
+	BlockVolume &vol = bld.getVolume();
+	vol.gather( map, hull.minx, hull.maxx, hull.miny, hull.maxy, hull.minz, hull.maxz, 2 );
+	vol.buildMasks( blocks );
+	uint64_t *exposed = bld.getExposedMask( vol.getMaskWords() );
+
 	for( int x = ltext.minx; x <= ltext.maxx; x++ ) {
-		lightMapColumn( bld, map, x, ltext.miny, allOne );
-		lightMapColumn( bld, map, x, ltext.maxy, allOne );
+		lightMapColumn( bld, vol, x, ltext.miny );
+		lightMapColumn( bld, vol, x, ltext.maxy );
 	}
 
 	for( int y = ltext.miny; y <= ltext.maxy; y++ ) {
-		lightMapColumn( bld, map, ltext.minx, y, allOne );
-		lightMapColumn( bld, map, ltext.maxx, y, allOne );
+		lightMapColumn( bld, vol, ltext.minx, y );
+		lightMapColumn( bld, vol, ltext.maxx, y );
 	}
 
 	for( int x = hull.minx; x <= hull.maxx; x++ ) {
 		for( int y = hull.miny; y <= hull.maxy; y++ ) {
-			MCMap::Column col;
-			if( map->getColumn( x, y, col ) ) {
-				MCMap::Column sides[4];
+			BlockVolume::Column col;
+			if( vol.getColumn( x, y, col ) ) {
+				BlockVolume::Column sides[4];
 				bool sideExists[4];
-				sideExists[0] = map->getColumn( x-1, y, sides[0] );
-				sideExists[1] = map->getColumn( x+1, y, sides[1] );
-				sideExists[2] = map->getColumn( x, y-1, sides[2] );
-				sideExists[3] = map->getColumn( x, y+1, sides[3] );
-				for( unsigned i = 0; i < 4; i++ ) {
-					if( !sideExists[i] ) {
-						sides[i].id = allOne;
-						sides[i].minZ = col.minZ;
-						sides[i].maxZ = col.maxZ;
-					}
-				}
-
+				sideExists[0] = vol.getColumn( x-1, y, sides[0] );
+				sideExists[1] = vol.getColumn( x+1, y, sides[1] );
+				sideExists[2] = vol.getColumn( x, y-1, sides[2] );
+				sideExists[3] = vol.getColumn( x, y+1, sides[3] );
 				lightMapColumn( bld, x, y, col, &sides[0] );
 
-				int stopatz = std::min( hull.maxz, col.maxZ );
-				for( int z = std::max( hull.minz, col.minZ ); z <= stopatz; z++ ) {
+				// Only the non-air part of the column can have geometry, and
+				// only blocks which are not walled in by solid blocks are visible
+				vol.getExposedMask( x, y, exposed );
+				int stopatz = std::min( hull.maxz, col.topZ );
+				for( int z = vol.nextInMask( exposed, std::max( hull.minz, col.bottomZ ), stopatz ); z <= stopatz; z = vol.nextInMask( exposed, z + 1, stopatz ) ) {
 					unsigned id = col.getId( z );
 					mcgeom::BlockGeometry *geom = blocks->getGeometry( id );
 					if( geom ) {
-						// First check the solidity of all adjacent blocks
 						mcgeom::IslandDesc ctx;
 						memset(&ctx, 0, sizeof(ctx));
 						for( unsigned i = 0; i < 4; i++ )
@@ -1062,13 +1319,6 @@ MCWorldMesh *MCWorldMesh::generateFromMCMap( MCMap *map, const MCBlockDesc *bloc
 								ctx.origin.sides[i].solid = !sideExists[i];
 							ctx.origin.sides[4].solid = z <= col.minZ;
 							ctx.origin.sides[5].solid = 0;
-						} else {
-							if( ctx.origin.sides[0].solid && ctx.origin.sides[1].solid && ctx.origin.sides[2].solid
-							 && ctx.origin.sides[3].solid && ctx.origin.sides[4].solid && ctx.origin.sides[5].solid ) {
-								// All adjacent blocks are solid
-								// There is no way to see this block
-								continue;
-							}
 						}
 
 						// The block is potentially visible
@@ -1085,15 +1335,21 @@ MCWorldMesh *MCWorldMesh::generateFromMCMap( MCMap *map, const MCBlockDesc *bloc
 						bld.toLocalSpace( ctx.origin.block.pos );
 						if( geom->beginEmit( bld.getGeometryCluster( id ), &ctx.origin ) ) {
 							ctx.origin.block.pos = worldSpacePos;
-							generateMCMapIslands( bld, geom, &ctx, map );
+							generateMCMapIslands( bld, geom, &ctx, vol );
 						}
 					}
 				}
+			} else {
+				bld.clearLightingColumn( x, y );
 			}
 		}
 	}
-	
-	delete[] allOne;
+
+	std::vector< mcgeom::Point > &glows = bld.getGlows();
+	for( std::vector< mcgeom::Point >::const_iterator it = glows.begin(); it != glows.end(); ++it )
+		glowAreaAround( bld, it->x, it->y, it->z );
+	glows.clear();
+	bld.clearBlockInfo();
 
 	// Output sign text
 	outputSignsFromMap( bld, map, hull.minx, hull.maxx, hull.miny, hull.maxy );
@@ -1226,11 +1482,23 @@ MCWorldMeshGroup::~MCWorldMeshGroup() {
 	}
 }
 
-MCWorldMeshGroup *MCWorldMeshGroup::generateFromMCMap( MCMap *map, const MCBlockDesc *blocks, Extents &ext ) {
+MeshScratch *MCWorldMeshGroup::newScratch() {
+	return new MeshScratch;
+}
+
+void MCWorldMeshGroup::deleteScratch( MeshScratch *scratch ) {
+	delete scratch;
+}
+
+void MCWorldMeshGroup::trimScratch( MeshScratch *scratch ) {
+	scratch->trim();
+}
+
+MCWorldMeshGroup *MCWorldMeshGroup::generateFromMCMap( MCMap *map, const MCBlockDesc *blocks, Extents &ext, MeshScratch *scratch ) {
 	MCWorldMeshGroup *wmeshg = new MCWorldMeshGroup;
 	if( !map->getRegions()->isAnvil() ) {
 		Extents ltext( ext.minx - 1, ext.maxx + 1, ext.miny - 1, ext.maxy + 1, ext.minz, ext.maxz );
-		wmeshg->firstMesh = MCWorldMesh::generateFromMCMap( map, blocks, ext, ltext );
+		wmeshg->firstMesh = MCWorldMesh::generateFromMCMap( map, blocks, ext, ltext, scratch );
 	} else {
 		Extents hull = ext;
 		map->getExtentsWithin( ext.minx, ext.maxx, ext.miny, ext.maxy, ext.minz, ext.maxz );
@@ -1240,7 +1508,7 @@ MCWorldMeshGroup *MCWorldMeshGroup::generateFromMCMap( MCMap *map, const MCBlock
 			hull.maxz = 127;
 
 		Extents ltext( hull.minx - 1, hull.maxx + 1, hull.miny - 1, hull.maxy + 1, hull.minz, hull.maxz );
-		wmeshg->firstMesh = MCWorldMesh::generateFromMCMap( map, blocks, hull, ltext );
+		wmeshg->firstMesh = MCWorldMesh::generateFromMCMap( map, blocks, hull, ltext, scratch );
 	}
 	return wmeshg;
 }
@@ -65,6 +65,7 @@ struct Extents {
 };
 
 class MeshBuilder;
+class MeshScratch;
 
 class MCWorldMesh {
 	friend class MeshBuilder;
@@ -73,7 +74,7 @@ class MCWorldMesh {
 public:
 	~MCWorldMesh();
 
-	static MCWorldMesh *generateFromMCMap( MCMap *map, const MCBlockDesc *blocks, Extents &hull, Extents &ltext );
+	static MCWorldMesh *generateFromMCMap( MCMap *map, const MCBlockDesc *blocks, Extents &hull, Extents &ltext, MeshScratch *scratch );
 
 	void finalizeLoad();
 	inline bool isEmpty() const { return meta == NULL; }
@@ -117,7 +118,12 @@ class MCWorldMeshGroup {
 public:
 	~MCWorldMeshGroup();
 
-	static MCWorldMeshGroup *generateFromMCMap( MCMap *map, const MCBlockDesc *blocks, Extents &ext );
+	// The scratch is busy until the mesh is finalized
+	static MCWorldMeshGroup *generateFromMCMap( MCMap *map, const MCBlockDesc *blocks, Extents &ext, MeshScratch *scratch );
+	static MeshScratch *newScratch();
+	static void deleteScratch( MeshScratch *scratch );
+	// Frees the scratch memory of a worker which has gone idle
+	static void trimScratch( MeshScratch *scratch );
 	
 	void finalizeLoad();
 	bool isEmpty() const;
@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #define _MEMPOOL_H
 
 #include <cassert>
+#include <cstdlib>
 #include <vector>
 
 
@@ -86,4 +87,98 @@ private:
 	int allocIncrement;
 };
 
+// Bump allocator which releases everything at once
+class MemoryArena {
+public:
+	// ----------------------------------------------------------------------------
+	explicit MemoryArena( size_t blockSize = 16*1024 )
+		: blocks(NULL), cursor(NULL), left(0), blockSize(blockSize)
+	{ }
+
+	// ----------------------------------------------------------------------------
+	~MemoryArena() {
+		release();
+	}
+
+	// ----------------------------------------------------------------------------
+	inline void *alloc( size_t sz ) {
+		sz = (sz + 7) & ~(size_t)7;
+		if( sz > left )
+			grow( sz );
+		void *p = cursor;
+		cursor += sz;
+		left -= sz;
+		return p;
+	}
+
+	// ----------------------------------------------------------------------------
+	template< typename T >
+	inline T *alloc( size_t n ) {
+		return (T*)alloc( n * sizeof(T) );
+	}
+
+	// ----------------------------------------------------------------------------
+	// Forgets all allocations, keeping one block big enough for all of them
+	void reset() {
+		if( blocks && blocks->next ) {
+			size_t total = 0;
+			for( Block *b = blocks; b; b = b->next )
+				total += b->size;
+			release();
+			blockSize = total;
+		}
+		if( blocks ) {
+			cursor = (unsigned char*)(blocks + 1);
+			left = blocks->size;
+		}
+	}
+
+	// ----------------------------------------------------------------------------
+	// Bytes held in blocks, used or not
+	size_t getSize() const {
+		size_t total = 0;
+		for( Block *b = blocks; b; b = b->next )
+			total += b->size;
+		return total;
+	}
+
+	// ----------------------------------------------------------------------------
+	void release() {
+		while( blocks ) {
+			Block *next = blocks->next;
+			::free( blocks );
+			blocks = next;
+		}
+		cursor = NULL;
+		left = 0;
+	}
+
+private:
+	struct Block {
+		Block *next;
+		size_t size;
+	};
+
+	// ----------------------------------------------------------------------------
+	void grow( size_t sz ) {
+		size_t size = blockSize;
+		while( size < sz )
+			size <<= 1;
+		// Each new block is bigger than the last
+		blockSize = size << 1;
+
+		Block *b = (Block*)malloc( sizeof(Block) + size );
+		b->next = blocks;
+		b->size = size;
+		blocks = b;
+		cursor = (unsigned char*)(b + 1);
+		left = size;
+	}
+
+	Block *blocks;
+	unsigned char *cursor;
+	size_t left;
+	size_t blockSize;
+};
+
 #endif
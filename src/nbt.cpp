@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <cstring>
 
 #include "nbt.h"
+#include "decompress.h"
 #include "endian.h"
 
 namespace nbt {
@@ -47,6 +48,7 @@ void Tag::destroyPayload() {
 	case TAG_List:       delete data.list; break;
 	case TAG_Compound:   delete data.comp; break;
 	case TAG_Int_Array:  delete[] data.ia; break;
+	case TAG_Long_Array: delete[] data.la; break;
 	default: assert( false );
 	}
 	type = TAG_Int;
@@ -57,7 +59,7 @@ Compound::~Compound() {
 		it->second.destroyPayload();
 }
 
-void Compound::eraseTag( const std::wstring &tagName ) {
+void Compound::eraseTag( const std::string &tagName ) {
 	iterator it = find( tagName );
 	if( it != end() ) {
 		it->second.destroyPayload();
@@ -65,7 +67,7 @@ void Compound::eraseTag( const std::wstring &tagName ) {
 	}
 }
 
-void Compound::replaceTag( const std::wstring &tagName, const Tag &newTag ) {
+void Compound::replaceTag( const std::string &tagName, const Tag &newTag ) {
 	eraseTag( tagName );
 	(*this)[tagName] = newTag;
 }
@@ -79,7 +81,7 @@ void Compound::printReadable( std::ostream &out, const char *pre ) const {
 	out << "{" << std::endl;
 	for( const_iterator it = begin(); it != end(); ++it ) {
 		out << pre << '\t';
-		std::string name( it->first.begin(), it->first.end() );
+		const std::string &name = it->first;
 		switch( it->second.type ) {
 		case TAG_Byte:
 			out << "Byte " << name << " = " << (unsigned)it->second.data.b << std::endl;
@@ -102,10 +104,9 @@ void Compound::printReadable( std::ostream &out, const char *pre ) const {
 		case TAG_Byte_Array:
 			out << "Data " << name << ", size = " << it->second.getArraySize() << std::endl;
 			break;
-		case TAG_String: {
-				std::string str( it->second.data.str->begin(), it->second.data.str->end() );
-				out << "String " << name << " = " << str << std::endl;
-			} break;
+		case TAG_String:
+			out << "String " << name << " = " << *it->second.data.str << std::endl;
+			break;
 		case TAG_List:
 			out << "List " << name << std::endl;
 			break;
@@ -120,6 +121,9 @@ void Compound::printReadable( std::ostream &out, const char *pre ) const {
 		case TAG_Int_Array:
 			out << "IntArray " << name << ", size = " << it->second.getArraySize() << std::endl;
 			break;
+		case TAG_Long_Array:
+			out << "LongArray " << name << ", size = " << it->second.getArraySize() << std::endl;
+			break;
 		default: assert( false );
 		}
 	}
@@ -140,17 +144,13 @@ class gzistream {
 public:
 	gzistream( const char *fn, unsigned idx ) {
 		// Read an NBT from an MCRegion file
-		in = Z_NULL;
-		fileNotFound = false;
-		cmpBuffer = NULL;
+		init();
 
 		uint32_t position, len;
 
 		FILE *f = fopen( fn, "rb" );
-		if( !f ) {
-			fileNotFound = true;
+		if( !f )
 			return;
-		}
 		if( idx < 1024 ) {
 			fseek( f, (long)(idx<<2), SEEK_SET );
 			fread( &position, 4, 1, f );
@@ -159,38 +159,46 @@ public:
 			position = idx;
 		}
 		if( position == 0 ) {
-			fileNotFound = true;
+			fclose( f );
 			return;
 		}
 		fseek( f, (long)position, SEEK_SET );
 		fread( &len, 4, 1, f );
 		len = bswap_from_big(len);
 
-		unsigned char version;
-		fread( &version, 1, 1, f );
+		unsigned char compression;
+		fread( &compression, 1, 1, f );
 		void *fileBuf = malloc( len );
-		fread( fileBuf, len-1, 1, f );
+		size_t got = len > 1 ? fread( fileBuf, 1, len-1, f ) : 0;
 		fclose( f );
 
-		uLongf bytesAvailable = 512*1024;
-		cmpBuffer = (unsigned char*)malloc( bytesAvailable );
-		uncompress( cmpBuffer, &bytesAvailable, (unsigned char*)fileBuf, len-1 );
+		setSource( decompress( (CompressionType)compression, fileBuf, got, scratch ) );
 		free( fileBuf );
-
-		bufferLeft = bytesAvailable;
-		cursor = &cmpBuffer[0];
 	}
-	gzistream( const char *fn )
-		: bufferLeft(0)
-	{
-		in = gzopen( const_cast<char*>(fn), "rb" );
-		fileNotFound = (in == Z_NULL);
-		cmpBuffer = fileNotFound ? NULL : (unsigned char*)malloc( BUFFER_SIZE );
+	explicit gzistream( const char *fn ) {
+		init();
+
+		FILE *f = fopen( fn, "rb" );
+		if( !f )
+			return;
+		fseek( f, 0, SEEK_END );
+		long len = ftell( f );
+		fseek( f, 0, SEEK_SET );
+		if( len <= 0 ) {
+			fclose( f );
+			return;
+		}
+		unsigned char *fileBuf = (unsigned char*)malloc( (size_t)len );
+		size_t got = fread( fileBuf, 1, (size_t)len, f );
+		fclose( f );
+
+		// Plain NBT files are read as they are
+		bool gzipped = got >= 2 && fileBuf[0] == 0x1f && fileBuf[1] == 0x8b;
+		setSource( decompress( gzipped ? COMPRESSION_GZIP : COMPRESSION_NONE, fileBuf, got, scratch ) );
+		free( fileBuf );
 	}
 	~gzistream() {
-		if( in != Z_NULL )
-			gzclose( in );
-		free( cmpBuffer );
+		releaseScratch( scratch, ownsScratch );
 	}
 
 	char get() { return read<char>(); }
@@ -205,31 +213,54 @@ public:
     return bswap_from_big(read<T>());
 	}
 
+	// Reads a count followed by that many big-endian values
+	template< typename T >
+	T *readArray( unsigned &count ) {
+		count = readlli<uint32_t,uint32_t>();
+		if( count > bufferLeft / sizeof(T) )
+			count = (unsigned)(bufferLeft / sizeof(T));
+		T *arr = new T[count];
+		read( arr, count * sizeof(T) );
+		bswap_array_from_big( arr, count );
+		return arr;
+	}
+
 	void read( void *dest, size_t sz ) {
-		while( sz > bufferLeft ) {
-			assert( in );
-
-			memcpy( dest, cursor, bufferLeft );
-			sz -= bufferLeft;
-			dest = (char*)dest + bufferLeft;
-			bufferLeft = (unsigned)gzread( in, cmpBuffer, BUFFER_SIZE );
-			cursor = &cmpBuffer[0];
+		if( sz > bufferLeft ) {
+			// Truncated data reads as zeros, which ends every compound
+			memset( (char*)dest + bufferLeft, 0, sz - bufferLeft );
+			sz = bufferLeft;
 		}
 
 		memcpy( dest, cursor, sz );
 		cursor += sz;
-		bufferLeft -= (unsigned)sz;
+		bufferLeft -= sz;
 	}
 
 	bool fileFound() { return !fileNotFound; }
 
 private:
-	enum { BUFFER_SIZE = 1024 };
-	unsigned char *cmpBuffer;
-	unsigned bufferLeft;
-	unsigned char *cursor;
+	void init() {
+		// A live nbt::Document may be holding the thread's buffer
+		scratch = borrowScratch( ownsScratch );
+		fileNotFound = true;
+		cursor = NULL;
+		bufferLeft = 0;
+	}
+
+	void setSource( bool decompressed ) {
+		if( !decompressed )
+			return;
+		cursor = scratch->data;
+		bufferLeft = scratch->size;
+		fileNotFound = false;
+	}
+
+	ScratchBuffer *scratch;
+	bool ownsScratch;
+	const unsigned char *cursor;
+	size_t bufferLeft;
 	bool fileNotFound;
-	gzFile in;
 };
 
 class nbtstream : private gzistream {
@@ -242,10 +273,10 @@ public:
 	{ }
 	~nbtstream() { }
 
-	void readNamedTag( std::wstring &name, Tag &tag ) {
+	void readNamedTag( std::string &name, Tag &tag ) {
 		tag.type = (TagType)get();
 		if( tag.type == TAG_End ) {
-			name = L"";
+			name.clear();
 		} else {
 			readString( name );
 			readTagPayload( tag );
@@ -269,7 +300,7 @@ private:
 			read( tag.data.bytes, tag.extra );
 			break;
 		case TAG_String:
-			tag.data.str = new std::wstring;
+			tag.data.str = new std::string;
 			readString( *tag.data.str );
 			break;
 		case TAG_List:
@@ -279,31 +310,21 @@ private:
 			tag.data.comp = readCompound();
 			break;
 		case TAG_Int_Array:
-			tag.extra = readlli<uint32_t,uint32_t>();
-			tag.data.ia = new int[tag.extra];
-			for( unsigned i = 0; i < tag.extra; i++ )
-				tag.data.ia[i] = readlli<int32_t, uint32_t>();
+			tag.data.ia = readArray<int>( tag.extra );
+			break;
+		case TAG_Long_Array:
+			tag.data.la = readArray<int64_t>( tag.extra );
 			break;
 		default:
 			assert( false );
 		}
 	}
 
-	void readString( std::wstring &str ) {
+	void readString( std::string &str ) {
 		unsigned len = (unsigned)readlli<int16_t,uint16_t>();
-		if( len == 0 ) {
-			str = L"";
-			return;
-		}
-
-		char *b = new char[len+1];
-		read( b, len );
-		b[len] = '\0';
-		wchar_t *d = new wchar_t[len+1];
-		mbstowcs( d, b, len+1 );
-		str = d;
-		delete[] d;
-		delete[] b;
+		str.resize( len );
+		if( len )
+			read( &str[0], len );
 	}
 
 	List *readList() {
@@ -322,7 +343,7 @@ private:
 
 	Compound *readCompound() {
 		Compound *comp = new Compound;
-		std::wstring name;
+		std::string name;
 		Tag tag;
 
 		while( true ) {
@@ -336,11 +357,11 @@ private:
 	}
 };
 
-Compound *readNBT( const char *filename, std::wstring *outerName ) {
+Compound *readNBT( const char *filename, std::string *outerName ) {
 	nbtstream is( filename );
 	if( is.fileFound() ) {
 		Tag tag;
-		std::wstring name;
+		std::string name;
 		is.readNamedTag( name, tag );
 		assert( tag.type == TAG_Compound );
 		if( outerName )
@@ -354,7 +375,7 @@ Compound *readFromRegionFile( const char *filename, unsigned idx ) {
 	nbtstream is( filename, idx );
 	if( is.fileFound() ) {
 		Tag tag;
-		std::wstring name;
+		std::string name;
 		is.readNamedTag( name, tag );
 		assert( tag.type == TAG_Compound );
 		return tag.data.comp;
@@ -404,7 +425,7 @@ public:
 	}
 	~nbtostream() { }
 
-	void writeNamedTag( const std::wstring &name, const Tag &tag ) {
+	void writeNamedTag( const std::string &name, const Tag &tag ) {
 		write( (unsigned char)tag.type );
 		if( tag.type != TAG_End ) {
 			//asdf
@@ -436,26 +457,31 @@ private:
 			writeCompound( tag.data.comp );
 			break;
 		case TAG_Int_Array:
-			writelli( (int32_t)tag.extra );
-			for( unsigned i = 0; i < tag.extra; i++ )
-				writelli( (uint32_t)tag.data.ia[i] );
+			writeArray( tag.data.ia, tag.extra );
+			break;
+		case TAG_Long_Array:
+			writeArray( tag.data.la, tag.extra );
 			break;
 		default:
 			assert( false );
 		}
 	}
 
-	void writeString( const std::wstring &str ) {
-		if( str.empty() ) {
-			writelli( (uint16_t)0 );
-			return;
-		}
+	template< typename T >
+	void writeArray( const T *arr, unsigned count ) {
+		writelli( (int32_t)count );
+		T *swapped = new T[count];
+		memcpy( swapped, arr, count * sizeof(T) );
+		bswap_array_to_big( swapped, count );
+		write( swapped, count * sizeof(T) );
+		delete[] swapped;
+	}
 
-		char *b = new char[str.length()*4+1];
-		size_t len = wcstombs( b, str.c_str(), str.length()*4+1 );
+	void writeString( const std::string &str ) {
+		size_t len = str.length() > 0xffff ? 0xffff : str.length();
 		writelli( (uint16_t)len );
-		write( b, len );
-		delete[] b;
+		if( len )
+			write( const_cast<char*>(str.data()), len );
 	}
 
 	void writeList( const List *l ) {
@@ -475,11 +501,11 @@ private:
 			writeNamedTag( it->first, it->second );
 		Tag endTag;
 		endTag.type = TAG_End;
-		writeNamedTag( L"", endTag );
+		writeNamedTag( std::string(), endTag );
 	}
 };
 
-void Compound::write( const char *filename, const std::wstring &outerName ) {
+void Compound::write( const char *filename, const std::string &outerName ) {
 	nbtostream nbtOut( filename );
 	Tag me;
 	me.type = TAG_Compound;
@@ -45,7 +45,8 @@ namespace nbt {
 		TAG_List		= 9,
 		TAG_Compound	= 10,
 		TAG_Int_Array   = 11,
-		TAG_Count       = 12
+		TAG_Long_Array  = 12,
+		TAG_Count       = 13
 	};
 
 	union TagData;
@@ -62,10 +63,11 @@ namespace nbt {
 		float f;
 		double d;
 		void *bytes;
-		std::wstring *str;
+		std::string *str; // UTF-8
 		List *list;
 		Compound *comp;
 		int *ia;
+		int64_t *la;
 	};
 
 	struct Tag {
@@ -84,11 +86,11 @@ namespace nbt {
 			: type(TAG_Double) { data.d = d; }
 		inline Tag( void *bytes, unsigned size )
 			: type(TAG_Byte_Array) { data.bytes = bytes; extra = size; }
-		inline Tag( wchar_t *str )
-			: type(TAG_String) { data.str = new std::wstring(str); }
-		inline Tag( const std::wstring &str )
-			: type(TAG_String) { data.str = new std::wstring(str); }
-		inline Tag( std::wstring *str )
+		inline Tag( const char *str )
+			: type(TAG_String) { data.str = new std::string(str); }
+		inline Tag( const std::string &str )
+			: type(TAG_String) { data.str = new std::string(str); }
+		inline Tag( std::string *str )
 			: type(TAG_String) { data.str = str; }
 		inline Tag( List *l )
 			: type(TAG_List) { data.list = l; }
@@ -96,6 +98,8 @@ namespace nbt {
 			: type(TAG_Compound) { data.comp = c; }
 		inline Tag( int *ints, unsigned n )
 			: type(TAG_Int_Array) { data.ia = ints; extra = n; }
+		inline Tag( int64_t *longs, unsigned n )
+			: type(TAG_Long_Array) { data.la = longs; extra = n; }
 
 		TagType type;
 		unsigned extra;
@@ -106,15 +110,16 @@ namespace nbt {
 		void destroyPayload();
 	};
 
-	class Compound : public std::map< std::wstring, Tag > {
+	// Tag names and strings are kept as the (modified) UTF-8 in the file
+	class Compound : public std::map< std::string, Tag > {
 	public:
 		inline Compound() { }
 		~Compound();
 
-		inline bool has( const std::wstring &what ) const { return find(what)!=end(); }
-		void eraseTag( const std::wstring &tagName );
-		void replaceTag( const std::wstring &tagName, const Tag &newTag );
-		void write( const char *filename, const std::wstring &outerName );
+		inline bool has( const std::string &what ) const { return find(what)!=end(); }
+		void eraseTag( const std::string &tagName );
+		void replaceTag( const std::string &tagName, const Tag &newTag );
+		void write( const char *filename, const std::string &outerName );
 		void printReadable( std::ostream &out, const char *pre = "" ) const;
 	};
 
@@ -130,7 +135,7 @@ namespace nbt {
 		TagType type;
 	};
 
-	Compound *readNBT( const char *filename, std::wstring *outerName = NULL );
+	Compound *readNBT( const char *filename, std::string *outerName = NULL );
 	Compound *readFromRegionFile( const char *filename, unsigned idx );
 	Compound *readFromRegionFileSector( const char *filename, unsigned idx );
 	inline Compound *readFromRegionFile( const char *filename, unsigned x, unsigned y ) {
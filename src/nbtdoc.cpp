@@ -0,0 +1,494 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include <cstdlib>
+#include <cstring>
+
+#include "nbtdoc.h"
+#include "decompress.h"
+#include "endian.h"
+
+namespace nbt {
+
+// Deeper trees are treated as corrupt
+#define MAX_DEPTH 256
+
+static const char *const atomNames[ATOM_COUNT] = {
+	"",
+	"Level",
+	"Sections",
+	"Biomes",
+	"TileEntities",
+	"Y",
+	"Blocks",
+	"Add",
+	"Data",
+	"BlockLight",
+	"SkyLight",
+	"id",
+	"x",
+	"y",
+	"z",
+	"Text1",
+	"Text2",
+	"Text3",
+	"Text4",
+};
+
+#define ATOM_TABLE_SIZE 64
+
+static inline unsigned hashName( const char *name, unsigned len ) {
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for( unsigned i = 0; i < len; i++ )
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+	return h & (ATOM_TABLE_SIZE - 1);
+}
+
+static struct AtomTable {
+	AtomTable() {
+		memset( slots, 0, sizeof(slots) );
+		for( unsigned a = 1; a < ATOM_COUNT; a++ ) {
+			unsigned i = hashName( atomNames[a], (unsigned)strlen( atomNames[a] ) );
+			while( slots[i] != ATOM_NONE )
+				i = (i + 1) & (ATOM_TABLE_SIZE - 1);
+			slots[i] = (unsigned char)a;
+		}
+	}
+	unsigned char slots[ATOM_TABLE_SIZE];
+} atomTable;
+
+Atom internName( const char *name, unsigned len ) {
+	for( unsigned i = hashName( name, len ); atomTable.slots[i] != ATOM_NONE; i = (i + 1) & (ATOM_TABLE_SIZE - 1) ) {
+		const char *atomName = atomNames[atomTable.slots[i]];
+		if( strlen( atomName ) == len && 0 == memcmp( atomName, name, len ) )
+			return (Atom)atomTable.slots[i];
+	}
+	return ATOM_NONE;
+}
+
+const char *getAtomName( Atom atom ) {
+	return atomNames[atom];
+}
+
+const Value *Value::get( const char *name ) const {
+	if( type != TAG_Compound )
+		return NULL;
+	size_t len = strlen( name );
+	for( unsigned i = 0; i < count; i++ ) {
+		if( fields[i].nameLen == len && 0 == memcmp( fields[i].name, name, len ) )
+			return &fields[i].value;
+	}
+	return NULL;
+}
+
+const Value *Value::get( const char *name, TagType type ) const {
+	const Value *v = get( name );
+	return v && v->type == type ? v : NULL;
+}
+
+const Value *Value::get( Atom atom ) const {
+	if( type != TAG_Compound )
+		return NULL;
+	for( unsigned i = 0; i < count; i++ ) {
+		if( fields[i].atom == atom )
+			return &fields[i].value;
+	}
+	return NULL;
+}
+
+const Value *Value::get( Atom atom, TagType type ) const {
+	const Value *v = get( atom );
+	return v && v->type == type ? v : NULL;
+}
+
+bool Value::equals( const char *s ) const {
+	return type == TAG_String && strlen( s ) == count && 0 == memcmp( str, s, count );
+}
+
+class DocumentParser {
+public:
+	DocumentParser( unsigned char *data, size_t len, MemoryArena &arena, std::vector< Field > &fieldStack )
+		: cursor(data), end(data + len), arena(arena), fieldStack(fieldStack)
+	{ }
+
+	bool readRoot( Value &root, const Schema *schema ) {
+		if( cursor >= end || *cursor++ != TAG_Compound )
+			return false;
+		Field f;
+		if( !readName( f ) )
+			return false;
+		root.type = TAG_Compound;
+		return readPayload( root, 0, schema );
+	}
+
+private:
+	inline size_t remaining() const { return (size_t)(end - cursor); }
+
+	template< typename T >
+	inline T readBig() {
+		T v;
+		memcpy( &v, cursor, sizeof(T) );
+		cursor += sizeof(T);
+		return bswap_from_big( v );
+	}
+
+	bool readName( Field &f ) {
+		if( remaining() < 2 )
+			return false;
+		f.nameLen = readBig<uint16_t>();
+		if( remaining() < f.nameLen )
+			return false;
+		f.name = (const char*)cursor;
+		cursor += f.nameLen;
+		return true;
+	}
+
+	bool readCount( unsigned elementSize, unsigned &count ) {
+		if( remaining() < 4 )
+			return false;
+		int32_t n = readBig<int32_t>();
+		if( n < 0 )
+			n = 0;
+		count = (unsigned)n;
+		return (size_t)count <= remaining() / elementSize;
+	}
+
+	static const Schema *findInSchema( const Schema *schema, const Field &f ) {
+		for( ; schema->name; schema++ ) {
+			if( strlen( schema->name ) == f.nameLen && 0 == memcmp( schema->name, f.name, f.nameLen ) )
+				return schema;
+		}
+		return NULL;
+	}
+
+	static unsigned minPayloadSize( unsigned type ) {
+		switch( type ) {
+		case TAG_Byte:       return 1;
+		case TAG_Short:      return 2;
+		case TAG_Int:
+		case TAG_Float:      return 4;
+		case TAG_Long:
+		case TAG_Double:     return 8;
+		case TAG_Byte_Array:
+		case TAG_Int_Array:
+		case TAG_Long_Array: return 4;
+		case TAG_String:     return 2;
+		case TAG_List:       return 5;
+		case TAG_Compound:   return 1;
+		default:             return 0;
+		}
+	}
+
+	bool readPayload( Value &v, unsigned depth, const Schema *schema ) {
+		switch( v.type ) {
+		case TAG_Byte:
+			if( remaining() < 1 )
+				return false;
+			v.b = (int8_t)*cursor++;
+			return true;
+		case TAG_Short:
+			if( remaining() < 2 )
+				return false;
+			v.s = readBig<int16_t>();
+			return true;
+		case TAG_Int:
+		case TAG_Float:
+			if( remaining() < 4 )
+				return false;
+			v.i = readBig<int32_t>();
+			return true;
+		case TAG_Long:
+		case TAG_Double:
+			if( remaining() < 8 )
+				return false;
+			v.l = readBig<int64_t>();
+			return true;
+		case TAG_Byte_Array:
+			if( !readCount( 1, v.count ) )
+				return false;
+			v.bytes = cursor;
+			cursor += v.count;
+			return true;
+		case TAG_String:
+			if( remaining() < 2 )
+				return false;
+			v.count = readBig<uint16_t>();
+			if( remaining() < v.count )
+				return false;
+			v.str = (const char*)cursor;
+			cursor += v.count;
+			return true;
+		case TAG_List:
+			return readList( v, depth, schema );
+		case TAG_Compound:
+			return readCompound( v, depth, schema );
+		case TAG_Int_Array:
+			return readArray( v.ints, v.count );
+		case TAG_Long_Array:
+			return readArray( v.longs, v.count );
+		default:
+			return false;
+		}
+	}
+
+	// Steps over a payload without looking at more of it than its lengths
+	bool skipPayload( unsigned type, unsigned depth ) {
+		unsigned count;
+		switch( type ) {
+		case TAG_Byte_Array:
+			if( !readCount( 1, count ) )
+				return false;
+			cursor += count;
+			return true;
+		case TAG_Int_Array:
+			if( !readCount( 4, count ) )
+				return false;
+			cursor += (size_t)count * 4;
+			return true;
+		case TAG_Long_Array:
+			if( !readCount( 8, count ) )
+				return false;
+			cursor += (size_t)count * 8;
+			return true;
+		case TAG_String:
+			if( remaining() < 2 )
+				return false;
+			count = readBig<uint16_t>();
+			if( remaining() < count )
+				return false;
+			cursor += count;
+			return true;
+		case TAG_List: {
+			if( depth >= MAX_DEPTH || remaining() < 1 )
+				return false;
+			unsigned listType = *cursor++;
+			unsigned elementSize = minPayloadSize( listType );
+			if( !readCount( elementSize ? elementSize : 1, count ) )
+				return false;
+			if( elementSize == 0 )
+				return count == 0;
+			if( listType <= TAG_Double ) {
+				// Fixed-size elements
+				cursor += (size_t)count * elementSize;
+				return true;
+			}
+			for( unsigned i = 0; i < count; i++ ) {
+				if( !skipPayload( listType, depth + 1 ) )
+					return false;
+			}
+			return true;
+		}
+		case TAG_Compound:
+			if( depth >= MAX_DEPTH )
+				return false;
+			while( true ) {
+				if( remaining() < 1 )
+					return false;
+				unsigned fieldType = *cursor++;
+				if( fieldType == TAG_End )
+					return true;
+				Field f;
+				if( !readName( f ) || !skipPayload( fieldType, depth + 1 ) )
+					return false;
+			}
+		default: {
+			unsigned sz = minPayloadSize( type );
+			if( sz == 0 || remaining() < sz )
+				return false;
+			cursor += sz;
+			return true;
+		}
+		}
+	}
+
+	bool readList( Value &v, unsigned depth, const Schema *schema ) {
+		if( depth >= MAX_DEPTH || remaining() < 1 )
+			return false;
+		v.listType = *cursor++;
+		unsigned elementSize = minPayloadSize( v.listType );
+		if( !readCount( elementSize ? elementSize : 1, v.count ) )
+			return false;
+		if( elementSize == 0 ) {
+			// Only empty lists may have no type
+			v.items = NULL;
+			return v.count == 0;
+		}
+
+		Value *items = arena.alloc<Value>( v.count );
+		for( unsigned i = 0; i < v.count; i++ ) {
+			items[i].type = v.listType;
+			items[i].listType = TAG_End;
+			items[i].count = 0;
+			if( !readPayload( items[i], depth + 1, schema ) )
+				return false;
+		}
+		v.items = items;
+		return true;
+	}
+
+	bool readCompound( Value &v, unsigned depth, const Schema *schema ) {
+		if( depth >= MAX_DEPTH )
+			return false;
+
+		// Fields are gathered on a shared stack, then copied to the arena
+		size_t base = fieldStack.size();
+		while( true ) {
+			if( remaining() < 1 )
+				return false;
+			unsigned type = *cursor++;
+			if( type == TAG_End )
+				break;
+
+			Field f;
+			if( !readName( f ) )
+				return false;
+			const Schema *child = NULL;
+			if( schema ) {
+				const Schema *entry = findInSchema( schema, f );
+				if( !entry ) {
+					if( !skipPayload( type, depth + 1 ) )
+						return false;
+					continue;
+				}
+				child = entry->children;
+			}
+			f.atom = (unsigned short)internName( f.name, f.nameLen );
+			f.value.type = (unsigned char)type;
+			f.value.listType = TAG_End;
+			f.value.count = 0;
+			if( !readPayload( f.value, depth + 1, child ) )
+				return false;
+			fieldStack.push_back( f );
+		}
+
+		v.count = (unsigned)(fieldStack.size() - base);
+		Field *fields = arena.alloc<Field>( v.count );
+		if( v.count )
+			memcpy( fields, &fieldStack[base], v.count * sizeof(Field) );
+		fieldStack.resize( base );
+		v.fields = fields;
+		return true;
+	}
+
+	template< typename T >
+	bool readArray( const T *&out, unsigned &count ) {
+		if( !readCount( sizeof(T), count ) )
+			return false;
+
+		T *arr;
+		if( ((size_t)cursor & (sizeof(T) - 1)) == 0 ) {
+			arr = (T*)cursor;
+		} else {
+			arr = arena.alloc<T>( count );
+			memcpy( arr, cursor, count * sizeof(T) );
+		}
+		cursor += count * sizeof(T);
+
+		bswap_array_from_big( arr, count );
+		out = arr;
+		return true;
+	}
+
+	unsigned char *cursor, *end;
+	MemoryArena &arena;
+	std::vector< Field > &fieldStack;
+};
+
+Document::Document()
+: buffer(NULL)
+, ownsBuffer(false)
+{
+	root.type = TAG_End;
+}
+
+Document::~Document() {
+	clear();
+}
+
+bool Document::parse( unsigned char *data, size_t len, const Schema *schema ) {
+	clear();
+
+	DocumentParser parser( data, len, arena, fieldStack );
+	root.listType = TAG_End;
+	root.count = 0;
+	if( !parser.readRoot( root, schema ) ) {
+		root.type = TAG_End;
+		fieldStack.clear();
+		return false;
+	}
+	return true;
+}
+
+bool Document::parse( ScratchBuffer *buffer, bool owned, const Schema *schema ) {
+	bool ok = parse( buffer->data, buffer->size, schema );
+	this->buffer = buffer;
+	ownsBuffer = owned;
+	return ok;
+}
+
+size_t Document::getMemoryUse() const {
+	return sizeof(Document) + ( ownsBuffer ? buffer->capacity : 0 ) + arena.getSize() + fieldStack.capacity() * sizeof(Field);
+}
+
+void Document::clear() {
+	if( buffer ) {
+		releaseScratch( buffer, ownsBuffer );
+		buffer = NULL;
+		ownsBuffer = false;
+	}
+	arena.reset();
+	root.type = TAG_End;
+}
+
+static Document *parseScratch( ScratchBuffer *scratch, bool owned, const Schema *schema ) {
+	Document *doc = new Document;
+	if( !doc->parse( scratch, owned, schema ) ) {
+		delete doc;
+		return NULL;
+	}
+	return doc;
+}
+
+Document *readDocumentFromRegionData( const void *chunkData, size_t available, const Schema *schema ) {
+	bool owned;
+	ScratchBuffer *scratch = borrowScratch( owned );
+	if( !decompressRegionChunk( chunkData, available, scratch ) ) {
+		releaseScratch( scratch, owned );
+		return NULL;
+	}
+	return parseScratch( scratch, owned, schema );
+}
+
+Document *readDocumentFromCompressedData( unsigned compression, const void *data, size_t len, const Schema *schema ) {
+	bool owned;
+	ScratchBuffer *scratch = borrowScratch( owned );
+	if( !decompress( (CompressionType)compression, data, len, scratch ) ) {
+		releaseScratch( scratch, owned );
+		return NULL;
+	}
+	return parseScratch( scratch, owned, schema );
+}
+
+} // namespace nbt
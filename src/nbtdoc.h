@@ -0,0 +1,157 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#ifndef NBTDOC_H
+#define NBTDOC_H
+
+#include <vector>
+#include "nbt.h"
+#include "mempool.h"
+
+class ScratchBuffer;
+
+namespace nbt {
+
+	struct Field;
+
+	// Tag names read on hot paths. The parser tags fields with these names
+	// so that looking them up only compares integers.
+	enum Atom {
+		ATOM_NONE = 0,
+		ATOM_Level,
+		ATOM_Sections,
+		ATOM_Biomes,
+		ATOM_TileEntities,
+		ATOM_Y,
+		ATOM_Blocks,
+		ATOM_Add,
+		ATOM_Data,
+		ATOM_BlockLight,
+		ATOM_SkyLight,
+		ATOM_id,
+		ATOM_x,
+		ATOM_y,
+		ATOM_z,
+		ATOM_Text1,
+		ATOM_Text2,
+		ATOM_Text3,
+		ATOM_Text4,
+		ATOM_COUNT
+	};
+
+	// Returns ATOM_NONE for names without an atom
+	Atom internName( const char *name, unsigned len );
+	const char *getAtomName( Atom atom );
+
+	// Read-only tag in a Document
+	// Strings, byte arrays and (when aligned) int and long arrays point into the
+	// document's buffer; strings are modified UTF-8 and not null-terminated
+	struct Value {
+		inline TagType getType() const { return (TagType)type; }
+		inline TagType getListType() const { return (TagType)listType; }
+		inline unsigned size() const { return count; }
+
+		// Compound lookups return NULL if the tag is missing or has another type
+		const Value *get( const char *name ) const;
+		const Value *get( const char *name, TagType type ) const;
+		const Value *get( Atom atom ) const;
+		const Value *get( Atom atom, TagType type ) const;
+		inline const Field *fieldAt( unsigned i ) const;
+		// List elements
+		inline const Value *at( unsigned i ) const { return &items[i]; }
+
+		bool equals( const char *s ) const;
+
+		unsigned char type;
+		unsigned char listType;
+		unsigned count;
+		union {
+			int8_t b;
+			int16_t s;
+			int32_t i;
+			int64_t l;
+			float f;
+			double d;
+			const unsigned char *bytes;
+			const char *str;
+			const Value *items;
+			const Field *fields;
+			const int32_t *ints;
+			const int64_t *longs;
+		};
+	};
+
+	struct Field {
+		const char *name;
+		unsigned short nameLen;
+		unsigned short atom;
+		Value value;
+	};
+
+	inline const Field *Value::fieldAt( unsigned i ) const { return &fields[i]; }
+
+	// Selects the tags of a compound which a parse keeps; a table ends with
+	// a NULL name. Tags which are not listed are skipped without decoding.
+	// The children of a list apply to each of its compound elements.
+	struct Schema {
+		const char *name;
+		const Schema *children; // NULL keeps the whole tag
+	};
+
+	// NBT tree whose nodes all live in one arena
+	class Document {
+	public:
+		Document();
+		~Document();
+
+		// Parses the NBT in data, which must outlive the document's use
+		// Arrays are byte-swapped in place
+		// If schema is not NULL, only the tags it lists under the root are kept
+		bool parse( unsigned char *data, size_t len, const Schema *schema = NULL );
+		// Parses the contents of a buffer from borrowScratch, which is given
+		// back when the document is cleared
+		bool parse( ScratchBuffer *buffer, bool owned, const Schema *schema = NULL );
+		void clear();
+
+		inline const Value *getRoot() const { return root.type == TAG_Compound ? &root : NULL; }
+		// Heap memory held by the document, including its buffer if it owns it
+		size_t getMemoryUse() const;
+
+	private:
+		Document( const Document& );
+		Document &operator=( const Document& );
+
+		MemoryArena arena;
+		ScratchBuffer *buffer;
+		bool ownsBuffer;
+		std::vector< Field > fieldStack;
+		Value root;
+	};
+
+	// Reads and parses a chunk from a region file image, starting at its length field
+	Document *readDocumentFromRegionData( const void *chunkData, size_t available, const Schema *schema = NULL );
+	Document *readDocumentFromCompressedData( unsigned compression, const void *data, size_t len, const Schema *schema = NULL );
+}
+
+#endif // NBTDOC_H
@@ -36,6 +36,9 @@ extern EihortShader *g_shader;
 extern jMatrix g_eyeMat;
 extern jPlane g_viewFrustum[];
 
+// Milliseconds a worker's mesh scratch is kept once loading goes idle
+static const unsigned SCRATCH_TRIM_DELAY = 10000;
+
 inline void keepMinLevel( unsigned &minLevel, int target, unsigned leafSize ) {
 	unsigned tgt = (unsigned)abs( target );
 	while( (leafSize<<minLevel) < tgt )
@@ -92,13 +95,16 @@ WorldQTree::WorldQTree( MCRegionMap *regions, MCBlockDesc *blocks, unsigned leaf
 
 	loadingMutex = SDL_CreateMutex();
 
+	chunkCache = new ChunkCache;
 	for( unsigned i = 0; i < g_nWorkers; i++ ) {
 		meshesLoading[i].leaf = NULL;
 		meshesLoading[i].loadedMesh = NULL;
+		meshesLoading[i].scratch = MCWorldMeshGroup::newScratch();
+		meshesLoading[i].lastUsed = 0;
 		if( regions->isAnvil() ) {
-			meshesLoading[i].map = new MCMap_Anvil( regions );
+			meshesLoading[i].map = new MCMap_Anvil( regions, chunkCache );
 		} else {
-			meshesLoading[i].map = new MCMap_MCRegion( regions );
+			meshesLoading[i].map = new MCMap_MCRegion( regions, chunkCache );
 		}
 	}
 
@@ -117,6 +123,12 @@ WorldQTree::~WorldQTree() {
 	while( unseenLeafHead )
 		freeLeafMesh( unseenLeafHead );
 
+	for( unsigned i = 0; i < g_nWorkers; i++ ) {
+		delete meshesLoading[i].map;
+		MCWorldMeshGroup::deleteScratch( meshesLoading[i].scratch );
+	}
+	delete chunkCache;
+
 	SDL_DestroyMutex( loadingMutex );
 }
 
@@ -318,6 +330,10 @@ void WorldQTree::drawLoadingCarat() {
 }
 
 void WorldQTree::chunkChanged( int x, int y ) {
+	// Cached chunks are keyed by Minecraft's coordinates
+	Coords2D chunkCoords = { y, x };
+	chunkCache->invalidate( chunkCoords );
+
 	SDL_mutexP( loadingMutex );
 
 	Extents ext;
@@ -427,6 +443,7 @@ WorldQTree::QTreeNode::QTreeNode( WorldQTree *qtree, unsigned level, int minz, i
 			leaf->lastRender = 0;
 			leaf->mesh = NULL;
 			leaf->load = true;
+			leaf->prefetched = false;
 			leaf->next = NULL;
 			leaf->prev = NULL;
 			leaf->lastGPUSize = qtree->minGPUAllowanceToLoad;
@@ -451,6 +468,7 @@ WorldQTree::QTreeNode::QTreeNode( WorldQTree *qtree, const QTreeNode *parent, un
 			leaf->lastRender = 0;
 			leaf->mesh = NULL;
 			leaf->load = true;
+			leaf->prefetched = false;
 			leaf->next = NULL;
 			leaf->prev = NULL;
 			leaf->lastGPUSize = qtree->minGPUAllowanceToLoad;
@@ -559,6 +577,17 @@ void WorldQTree::completeLoading() {
 	if( nMeshesLoading == 0 ) {
 		for( unsigned i = 0; i < g_nWorkers; i++ )
 			meshesLoading[i].map->clearAllLoadedChunks();
+		// Loading is idle, so this is a good time to free old region descriptors
+		regions->reclaimRetiredRegions();
+
+		// Workers which have been idle for a while give back their scratch
+		unsigned now = SDL_GetTicks();
+		for( unsigned i = 0; i < g_nWorkers; i++ ) {
+			if( meshesLoading[i].lastUsed && now - meshesLoading[i].lastUsed > SCRATCH_TRIM_DELAY ) {
+				MCWorldMeshGroup::trimScratch( meshesLoading[i].scratch );
+				meshesLoading[i].lastUsed = 0;
+			}
+		}
 	}
 
 	if( toAppend ) {
@@ -646,7 +675,24 @@ void WorldQTree::generateRenderList( QTreeNode *node, QTreeLeaf **lists, unsigne
 						mergeLeafIntoRenderLists( lists, maxn, leaf );
 					}
 				}
-				if( leaf->load && nMeshesLoading < g_nWorkers && !holdLoading ) {
+				if( !leaf->load || holdLoading )
+					continue;
+				Extents leafExt = node->ext;
+				splitExtents( &leafExt, i );
+				if( !leaf->mesh && !regions->hasChunksIn( shift_right( leafExt.miny, 4 ), shift_right( leafExt.maxy, 4 ),
+					shift_right( leafExt.minx, 4 ), shift_right( leafExt.maxx, 4 ) ) ) {
+					// There are no chunks to mesh, so there is no need
+					// to bother a worker - it is loaded and empty
+					leaf->load = false;
+					leaf->lastGPUSize = 0;
+					continue;
+				}
+				if( !leaf->prefetched && leaf->distance < limitLoadDistance ) {
+					// Start reading the chunks in while the leaf waits for a worker
+					prefetchExtents( leafExt );
+					leaf->prefetched = true;
+				}
+				if( nMeshesLoading < g_nWorkers ) {
 					if( leaf->distance >= limitLoadDistance ) {
 						newLoadDistanceLimit = std::min( leaf->distance, newLoadDistanceLimit );
 						continue;
@@ -654,10 +700,11 @@ void WorldQTree::generateRenderList( QTreeNode *node, QTreeLeaf **lists, unsigne
 					for( unsigned j = 0; j < g_nWorkers; j++ ) {
 						if( !meshesLoading[j].leaf ) {
 							leaf->load = false;
+							leaf->prefetched = false;
 							meshesLoading[j].leaf = leaf;
-							meshesLoading[j].loadingExt = node->ext;
-							splitExtents( &meshesLoading[j].loadingExt, i );
+							meshesLoading[j].loadingExt = leafExt;
 							meshesLoading[j].blocks = blockDesc;
+							meshesLoading[j].lastUsed = std::max( 1u, (unsigned)SDL_GetTicks() );
 							g_workers[j]->doTask( loadMesh_worker, &meshesLoading[j] );
 							blockDesc->lock();
 							nMeshesLoading++;
@@ -853,9 +900,25 @@ void WorldQTree::splitExtents( Extents *ext, unsigned corner ) {
 	}
 }
 
+void WorldQTree::prefetchExtents( const Extents &ext ) {
+	// The mesher looks up to two blocks outside of the area when lighting
+	// Chunk coordinates are swapped relative to block coordinates
+	int minChunkX = shift_right( ext.miny - 2, 4 ), maxChunkX = shift_right( ext.maxy + 2, 4 );
+	int minChunkY = shift_right( ext.minx - 2, 4 ), maxChunkY = shift_right( ext.maxx + 2, 4 );
+
+	std::vector< Coords2D > chunks;
+	for( int cx = minChunkX; cx <= maxChunkX; cx++ ) {
+		for( int cy = minChunkY; cy <= maxChunkY; cy++ ) {
+			Coords2D coords = { cx, cy };
+			chunks.push_back( coords );
+		}
+	}
+	regions->prefetchChunks( chunks );
+}
+
 void WorldQTree::loadMesh_worker( void *ldmesh_cookie ) {
 	WorldQTree::LoadingMesh *ldmesh = (WorldQTree::LoadingMesh*)ldmesh_cookie;
-	ldmesh->loadedMesh = MCWorldMeshGroup::generateFromMCMap( ldmesh->map, ldmesh->blocks, ldmesh->loadingExt );
+	ldmesh->loadedMesh = MCWorldMeshGroup::generateFromMCMap( ldmesh->map, ldmesh->blocks, ldmesh->loadingExt, ldmesh->scratch );
 	g_needRefresh = true;
 }
 
@@ -970,6 +1033,7 @@ int WorldQTree::lua_pauseLoading( lua_State *L ) {
 
 int WorldQTree::lua_reloadAll( lua_State *L ) {
 	WorldQTree *qtree = getLuaObjectArg<WorldQTree>( L, 1, WORLDQTREE_META );
+	qtree->chunkCache->invalidateAll();
 	qtree->kickOutAllMeshes();
 	qtree->regions->checkForRegionChanges();
 	return 0;
@@ -984,6 +1048,12 @@ int WorldQTree::lua_reloadRegion( lua_State *L ) {
 	ext.maxy = (int)luaL_checknumber( L, 5 );
 	ext.minz = 0;
 	ext.maxz = 127;
+	for( int cx = shift_right( ext.minx, 4 ); cx <= shift_right( ext.maxx, 4 ); cx++ ) {
+		for( int cy = shift_right( ext.miny, 4 ); cy <= shift_right( ext.maxy, 4 ); cy++ ) {
+			Coords2D chunkCoords = { cy, cx };
+			qtree->chunkCache->invalidate( chunkCoords );
+		}
+	}
 	qtree->kickOutTheseMeshes( &ext );
 	qtree->regions->checkForRegionChanges();
 	return 0;
@@ -1010,6 +1080,26 @@ int WorldQTree::lua_getLastFrameStats( lua_State *L ) {
 	return 4;
 }
 
+int WorldQTree::lua_setChunkCacheSize( lua_State *L ) {
+	WorldQTree *qtree = getLuaObjectArg<WorldQTree>( L, 1, WORLDQTREE_META );
+	lua_Number bytes = luaL_checknumber( L, 2 );
+	luaL_argcheck( L, bytes >= 0, 2, "Cache size must not be negative" );
+	qtree->chunkCache->setMaxBytes( bytes < (lua_Number)(size_t)-1 ? (size_t)bytes : (size_t)-1 );
+	return 0;
+}
+
+int WorldQTree::lua_getChunkCacheStats( lua_State *L ) {
+	WorldQTree *qtree = getLuaObjectArg<WorldQTree>( L, 1, WORLDQTREE_META );
+	ChunkCache::Stats stats;
+	qtree->chunkCache->getStats( stats );
+	lua_pushnumber( L, (lua_Number)stats.hits );
+	lua_pushnumber( L, (lua_Number)stats.misses );
+	lua_pushnumber( L, (lua_Number)stats.evictions );
+	lua_pushnumber( L, (lua_Number)stats.bytesResident );
+	lua_pushnumber( L, stats.chunksResident );
+	return 5;
+}
+
 int WorldQTree::lua_render( lua_State *L ) {
 	WorldQTree *qtree = getLuaObjectArg<WorldQTree>( L, 1, WORLDQTREE_META );
 	qtree->draw();
@@ -1046,6 +1136,8 @@ static const luaL_Reg WorldQTree_functions[] = {
 	{ "setGpuAllowance", &WorldQTree::lua_setGpuAllowance },
 	{ "getGpuAllowanceLeft", &WorldQTree::lua_getGpuAllowance },
 	{ "getLastFrameStats", &WorldQTree::lua_getLastFrameStats },
+	{ "setChunkCacheSize", &WorldQTree::lua_setChunkCacheSize },
+	{ "getChunkCacheStats", &WorldQTree::lua_getChunkCacheStats },
 
 	{ "render", &WorldQTree::lua_render },
 	{ "destroy", &WorldQTree::lua_destroy },
@@ -73,6 +73,8 @@ public:
 	static int lua_setGpuAllowance( lua_State *L );
 	static int lua_getGpuAllowance( lua_State *L );
 	static int lua_getLastFrameStats( lua_State *L );
+	static int lua_setChunkCacheSize( lua_State *L );
+	static int lua_getChunkCacheStats( lua_State *L );
 	static int lua_render( lua_State *L );
 	static void createNew( lua_State *L, MCRegionMap *regions, MCBlockDesc *blocks, unsigned leafShift );
 	static int lua_destroy( lua_State *L );
@@ -88,6 +90,7 @@ private:
 		unsigned lastGPUSize;
 		Extents lastExtents;
 		bool load;
+		bool prefetched;
 	};
 
 	struct QTreeNode {
@@ -109,6 +112,7 @@ private:
 	void completeLoading();
 	void freeLeafMesh( QTreeLeaf *leaf );
 	void generateRenderList( QTreeNode *node, QTreeLeaf **lists, unsigned &maxn );
+	void prefetchExtents( const Extents &ext );
 	static void mergeLeafIntoRenderLists( QTreeLeaf **lists, unsigned &maxn, QTreeLeaf *leaf );
 	static QTreeLeaf *mergeRenderLists( QTreeLeaf *list1, QTreeLeaf *list2 );
 	static QTreeLeaf *mergeRenderLists( QTreeLeaf *list1, QTreeLeaf *list2, QTreeLeaf *&tail );
@@ -124,6 +128,8 @@ private:
 		MCWorldMeshGroup *loadedMesh;
 		const MCBlockDesc *blocks;
 		MCMap *map;
+		MeshScratch *scratch;
+		unsigned lastUsed; // SDL_GetTicks() when the last mesh was started; 0 once trimmed
 		Extents loadingExt;
 	};
 
@@ -132,6 +138,7 @@ private:
 	void buildViewFrustum();
 
 	LoadingMesh meshesLoading[MAX_WORKERS];
+	ChunkCache *chunkCache;
 	int newMeshAllowance;
 	unsigned gpuAllowanceLeft;
 	unsigned minGPUAllowanceToLoad;
@@ -0,0 +1,84 @@
+/* Copyright (c) 2012, Jason Lloyd-Price
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+// Checks the vectorized ChunkSection::decodeStates against the scalar loop
+// Built and run by "make check"
+
+#include <cstdio>
+#include <cstring>
+
+#include "chunksection.h"
+
+// Fixed-seed generator, so failures can be reproduced
+static uint32_t rngState = 12345;
+static unsigned char nextByte() {
+	rngState = rngState * 1664525u + 1013904223u;
+	return (unsigned char)(rngState >> 24);
+}
+
+int main() {
+#if defined(__AVX2__)
+	const char *path = "AVX2";
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	const char *path = "SSE2";
+#else
+	const char *path = "scalar";
+#endif
+
+	// Partial runs of 16 leave tails of every length for the scalar loop
+	static const unsigned counts[] = { 0, 1, 2, 15, 16, 17, 31, 33, 47, 255, 4079, 4081, 4095, ChunkSection::BLOCKS };
+	const unsigned nCounts = sizeof(counts) / sizeof(counts[0]);
+	static unsigned char blocks[ChunkSection::BLOCKS], add[ChunkSection::BLOCKS/2], data[ChunkSection::BLOCKS/2];
+	static uint32_t expected[ChunkSection::BLOCKS], got[ChunkSection::BLOCKS];
+
+	unsigned failures = 0;
+	for( unsigned round = 0; round < 64; round++ ) {
+		for( unsigned i = 0; i < ChunkSection::BLOCKS; i++ )
+			blocks[i] = nextByte();
+		for( unsigned i = 0; i < ChunkSection::BLOCKS/2; i++ ) {
+			add[i] = nextByte();
+			data[i] = nextByte();
+		}
+
+		for( unsigned c = 0; c < nCounts; c++ ) {
+			for( unsigned withAdd = 0; withAdd < 2; withAdd++ ) {
+				const unsigned char *addSrc = withAdd ? add : NULL;
+				memset( expected, 0xcd, sizeof(expected) );
+				memset( got, 0xcd, sizeof(got) );
+				ChunkSection::decodeStatesScalar( blocks, addSrc, data, expected, counts[c] );
+				ChunkSection::decodeStates( blocks, addSrc, data, got, counts[c] );
+				// Also catches writes past the end of the range
+				if( memcmp( expected, got, sizeof(got) ) != 0 ) {
+					printf( "decodeStates (%s) mismatch: round %u, count %u, %s Add\n",
+						path, round, counts[c], withAdd ? "with" : "without" );
+					failures++;
+				}
+			}
+		}
+	}
+
+	if( failures )
+		return 1;
+	printf( "decodeStates (%s) matches the scalar loop\n", path );
+	return 0;
+}